@@ -6,6 +6,7 @@
 #include <stdexcept>
 #include <cstring>
 #include <atomic>
+#include <iostream>
 
 using namespace std;
 
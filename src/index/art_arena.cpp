@@ -0,0 +1,108 @@
+#include <sys/mman.h>
+#include <mutex>
+#include <new>
+
+#include "art_arena.h"
+#include "common/common.h"
+
+namespace {
+    /* free list heads are an index in the low half and a count of pops and pushes in the high one, against ABA */
+    uint64_t nextHead(uint64_t head, uint32_t index) {
+        return ((head >> 32) + 1) << 32 | index;
+    }
+
+    /* link(i) is where the free element i keeps the index of the one after it, 0 ends the list */
+    template<typename Link>
+    uint32_t pop(std::atomic<uint64_t> &head, Link link) {
+        uint64_t h = head.load(std::memory_order_acquire);
+        while (uint32_t(h) != 0) {
+            /* may already be reused by another thread, then the count has moved and the CAS fails */
+            uint32_t next = __atomic_load_n(link(uint32_t(h)), __ATOMIC_RELAXED);
+            if (head.compare_exchange_weak(h, nextHead(h, next), std::memory_order_acquire)) {
+                return uint32_t(h);
+            }
+        }
+        return 0;
+    }
+
+    template<typename Link>
+    void push(std::atomic<uint64_t> &head, uint32_t index, Link link) {
+        uint64_t h = head.load(std::memory_order_relaxed);
+        do {
+            __atomic_store_n(link(index), uint32_t(h), __ATOMIC_RELAXED);
+        } while (!head.compare_exchange_weak(h, nextHead(h, index), std::memory_order_release));
+    }
+}
+
+namespace Index {
+
+    char *NodeArena::base_ = nullptr;
+
+    /* line and cell 0 are never handed out, so no reference to them is ever 0 */
+    std::atomic<uint64_t> NodeArena::nextLine_{1};
+
+    std::atomic<uint64_t> NodeArena::nextCell_{1};
+
+    std::atomic<uint64_t> NodeArena::freeNodes_[MAX_LINES];
+
+    std::atomic<uint64_t> NodeArena::freeCells_{0};
+
+    void NodeArena::reserve() {
+        static std::once_flag once;
+        std::call_once(once, [] {
+            /* address space only, pages are backed as they are first written */
+            void *p = mmap(nullptr, NODE_SPACE + CELL_SPACE, PROT_READ | PROT_WRITE,
+                           MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+            if (p == MAP_FAILED) {
+                throw std::bad_alloc();
+            }
+            base_ = static_cast<char *>(p);
+        });
+    }
+
+    void *NodeArena::allocNode(size_t size) {
+        size_t lines = (size + LINE - 1) / LINE;
+        ASSERT(lines < MAX_LINES, "node too large for the arena");
+        reserve();
+        auto link = [](uint32_t line) { return static_cast<uint32_t *>(atLine(line)); };
+        uint32_t line = pop(freeNodes_[lines], link);
+        if (line == 0) {
+            uint64_t next = nextLine_.fetch_add(lines);
+            if (next + lines > NODE_SPACE / LINE) {
+                throw std::bad_alloc();
+            }
+            line = uint32_t(next);
+        }
+        return atLine(line);
+    }
+
+    void NodeArena::freeNode(void *p, size_t size) {
+        size_t lines = (size + LINE - 1) / LINE;
+        auto link = [](uint32_t line) { return static_cast<uint32_t *>(atLine(line)); };
+        push(freeNodes_[lines], lineOf(p), link);
+    }
+
+    uint32_t NodeArena::newCell(uint64_t word) {
+        reserve();
+        auto link = [](uint32_t cell) { return reinterpret_cast<uint32_t *>(cells() + cell); };
+        uint32_t cell = pop(freeCells_, link);
+        if (cell == 0) {
+            uint64_t next = nextCell_.fetch_add(1);
+            if (next >= CELL_SPACE / sizeof(uint64_t)) {
+                throw std::bad_alloc();
+            }
+            cell = uint32_t(next);
+        }
+        __atomic_store_n(cells() + cell, word, __ATOMIC_RELAXED);
+        return cell;
+    }
+
+    void NodeArena::freeCell(uint32_t cell) {
+        auto link = [](uint32_t cell) { return reinterpret_cast<uint32_t *>(cells() + cell); };
+        push(freeCells_, cell, link);
+    }
+
+    size_t NodeArena::reservedBytes() {
+        return (nextLine_.load() - 1) * LINE + (nextCell_.load() - 1) * sizeof(uint64_t);
+    }
+}
@@ -0,0 +1,70 @@
+#pragma once
+
+#include <cstdint>
+#include <cstddef>
+#include <atomic>
+
+namespace Index {
+
+    /**
+     * Process wide arena for nodes and leaf cells, one reservation made on first use and never
+     * given back, so a node is named by its cache line index and a leaf cell by its 8-byte
+     * index, both fitting in 32 bits. Built with ART_ARENA_REFS the nodes allocate themselves
+     * here and store their children as such indexes (see Slot in art_node.h).
+     *
+     * Freed memory goes to a LIFO list per size and is reused for the same size only. Since the
+     * mapping stays, a stale index read by an optimistic reader still points at readable memory;
+     * the version check that follows the read tells it apart.
+     */
+    class NodeArena {
+    public:
+        static const size_t LINE = 64;
+
+        /* 2^29 lines: a line index shifted left by the two type bits stays below bit 31 */
+        static const size_t NODE_SPACE = size_t(1) << 35;
+
+        /* 2^30 cells: a cell index leaves two bits of a reference for the leaf and cell flags */
+        static const size_t CELL_SPACE = size_t(1) << 33;
+
+        /* size rounded up to whole lines, line aligned */
+        static void *allocNode(size_t size);
+
+        static void freeNode(void *p, size_t size);
+
+        static uint32_t lineOf(const void *p) {
+            return uint32_t((static_cast<const char *>(p) - base_) / LINE);
+        }
+
+        static void *atLine(uint32_t line) {
+            return base_ + size_t(line) * LINE;
+        }
+
+        /* a cell holding word, its index is never 0 */
+        static uint32_t newCell(uint64_t word);
+
+        static void freeCell(uint32_t cell);
+
+        static uint64_t cellWord(uint32_t cell) {
+            return __atomic_load_n(cells() + cell, __ATOMIC_RELAXED);
+        }
+
+        /* bytes ever handed out, freed ones included */
+        static size_t reservedBytes();
+
+    private:
+        /* line counts of the sizes kept apart on free, every node type is below it */
+        static const size_t MAX_LINES = 64;
+
+        static char *base_;
+        static std::atomic<uint64_t> nextLine_;
+        static std::atomic<uint64_t> nextCell_;
+        static std::atomic<uint64_t> freeNodes_[MAX_LINES];
+        static std::atomic<uint64_t> freeCells_;
+
+        static uint64_t *cells() {
+            return reinterpret_cast<uint64_t *>(base_ + NODE_SPACE);
+        }
+
+        static void reserve();
+    };
+}
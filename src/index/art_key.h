@@ -1,17 +1,26 @@
 #pragma once
 
 #include <cstdint>
+#include <string>
 #include "common/common.h"
 
 namespace Index {
 
+    /* KeyLen of a tree whose keys have variable length, see KEY<VAR_KEY_LEN> */
+    const uint16_t VAR_KEY_LEN = 0;
+
+    const uint16_t MAX_VAR_KEY_LEN = 255;
+
     template<uint16_t KeyLen>
     class KEY {
     private:
         uint8_t keys_[KeyLen];
 
     public:
-        KEY(uint8_t *ptr, uint16_t len) {
+        /* upper bound of getKeyLen(), i.e. of the depth of a tree over these keys */
+        static constexpr uint16_t MAX_LEN = KeyLen;
+
+        KEY(const uint8_t *ptr, uint16_t len) {
             std::memcpy(keys_, ptr, len);
         }
 
@@ -23,33 +32,21 @@ namespace Index {
             std::memset(keys_, 0, KeyLen);
         }
 
-        bool operator==(const KEY &key) const {
-            if (sizeof(key) != KeyLen) return false;
-
-            for (int i = 0; i < KeyLen; i++) {
-                if (keys_[i] != key.keys_[i]) return false;
-            }
+        KEY &operator=(const KEY &key) {
+            std::memcpy(keys_, key.keys_, KeyLen);
+            return *this;
+        }
 
-            return true;
+        bool operator==(const KEY &key) const {
+            return std::memcmp(keys_, key.keys_, KeyLen) == 0;
         }
 
         bool operator!=(const KEY &key) const {
-            if (sizeof(key) == KeyLen) return true;
-
-            for (int i = 0; i < KeyLen; i++) {
-                if (keys_[i] != key.keys_[i]) return true;
-            }
-
-            return false;
+            return !(*this == key);
         }
 
         bool operator<(const KEY &key) const {
-            for (int i = 0; i < KeyLen; i++) {
-                if (keys_[i] < key.keys_[i]) {
-                    return true;
-                }
-            }
-            return false;
+            return std::memcmp(keys_, key.keys_, KeyLen) < 0;
         }
 
         uint8_t &operator[](uint16_t i) {
@@ -66,4 +63,83 @@ namespace Index {
             return KeyLen;
         }
     };
-}
\ No newline at end of file
+
+    /**
+     * Variable-length key. The bytes are stored inline followed by a 0 terminator that is
+     * part of the key, which makes the key set prefix-free: no key can end on the path of
+     * another one, so leaves stay at the end of a path exactly as with fixed-length keys,
+     * and byte order of the terminated keys is the string order. Keys must not contain 0.
+     */
+    template<>
+    class KEY<VAR_KEY_LEN> {
+    private:
+        uint16_t len_;
+        uint8_t keys_[MAX_VAR_KEY_LEN + 1];
+
+    public:
+        static constexpr uint16_t MAX_LEN = MAX_VAR_KEY_LEN + 1;
+
+        KEY(const uint8_t *ptr, uint16_t len) {
+            ASSERT(len <= MAX_VAR_KEY_LEN, "key too long " << len);
+            ASSERT(std::memchr(ptr, 0, len) == nullptr, "0 byte inside a variable-length key");
+            std::memcpy(keys_, ptr, len);
+            keys_[len] = 0;
+            len_ = len + 1;
+        }
+
+        explicit KEY(const std::string &str) : KEY(reinterpret_cast<const uint8_t *>(str.data()), str.size()) {}
+
+        KEY(const KEY &key) {
+            len_ = key.len_;
+            std::memcpy(keys_, key.keys_, len_);
+        }
+
+        KEY() {
+            keys_[0] = 0;
+            len_ = 1;
+        }
+
+        KEY &operator=(const KEY &key) {
+            len_ = key.len_;
+            std::memcpy(keys_, key.keys_, len_);
+            return *this;
+        }
+
+        bool operator==(const KEY &key) const {
+            return len_ == key.len_ && std::memcmp(keys_, key.keys_, len_) == 0;
+        }
+
+        bool operator!=(const KEY &key) const {
+            return !(*this == key);
+        }
+
+        bool operator<(const KEY &key) const {
+            int cmp = std::memcmp(keys_, key.keys_, len_ < key.len_ ? len_ : key.len_);
+            return cmp < 0 || (cmp == 0 && len_ < key.len_);
+        }
+
+        uint8_t &operator[](uint16_t i) {
+            ASSERT(i < MAX_LEN, "idx over range %d" << i);
+            return keys_[i];
+        }
+
+        const uint8_t &operator[](uint16_t i) const {
+            ASSERT(i < len_, "idx over range %d" << i);
+            return keys_[i];
+        }
+
+        /* length including the terminator */
+        uint16_t getKeyLen() const {
+            return len_;
+        }
+
+        /* used when a key is rebuilt byte by byte from the tree, the terminator is already in place */
+        void setKeyLen(uint16_t len) {
+            len_ = len;
+        }
+
+        std::string toString() const {
+            return std::string(reinterpret_cast<const char *>(keys_), len_ - 1);
+        }
+    };
+}
@@ -42,51 +42,68 @@ namespace Index {
         }
     }
 
-    N *N::getChild(N *cur, const uint8_t k) {
+    template<typename Big, typename Small>
+    void N::removeShrink(Big *big, Small *small, N *parent, uint8_t pk, uint8_t key) {
+        /* big stays as it was for readers that do not lock, so key is dropped from the copy */
+        small->setPrefix(big->getPrefix(), big->getPrefixLen());
+        big->copyTo(small);
+        small->removeChild(key);
+
+        N::changeChild(parent, pk, small);
+    }
+
+    void N::removeAndShrink(N *cur, N *parent, uint8_t pk, uint8_t key, Index::ArtObjPool *pool) {
         switch (cur->getType()) {
-            case NT4: {
-                auto n = static_cast<N4 *>(cur);
-                return n->getChild(k);
-            }
+            case NT4:
+                __builtin_unreachable();
             case NT16: {
-                auto n = static_cast<N16 *>(cur);
-                return n->getChild(k);
+                auto big = static_cast<N16 *>(cur);
+                auto small = static_cast<N4 *>(pool->newNode(NT4));
+                removeShrink<N16, N4>(big, small, parent, pk, key);
+                break;
             }
             case NT48: {
-                auto n = static_cast<N48 *>(cur);
-                return n->getChild(k);
+                auto big = static_cast<N48 *>(cur);
+                auto small = static_cast<N16 *>(pool->newNode(NT16));
+                removeShrink<N48, N16>(big, small, parent, pk, key);
+                break;
             }
             case NT256: {
-                auto n = static_cast<N256 *>(cur);
-                return n->getChild(k);
+                auto big = static_cast<N256 *>(cur);
+                auto small = static_cast<N48 *>(pool->newNode(NT48));
+                removeShrink<N256, N48>(big, small, parent, pk, key);
+                break;
             }
         }
-        __builtin_unreachable();
     }
 
-    void N::setChild(N *cur, const uint8_t k, N *child) {
+    N *N::getChild(const N *cur, const uint8_t k) {
+        /* kept as the plain switch the descent used before visit, art_node_dispatch_test times it */
         switch (cur->getType()) {
             case NT4: {
-                auto n = static_cast<N4 *>(cur);
-                n->setChild(k, child);
-                break;
+                auto n = static_cast<const N4 *>(cur);
+                return n->getChild(k);
             }
             case NT16: {
-                auto n = static_cast<N16 *>(cur);
-                n->setChild(k, child);
-                break;
+                auto n = static_cast<const N16 *>(cur);
+                return n->getChild(k);
             }
             case NT48: {
-                auto n = static_cast<N48 *>(cur);
-                n->setChild(k, child);
-                break;
+                auto n = static_cast<const N48 *>(cur);
+                return n->getChild(k);
             }
             case NT256: {
-                auto n = static_cast<N256 *>(cur);
-                n->setChild(k, child);
-                break;
+                auto n = static_cast<const N256 *>(cur);
+                return n->getChild(k);
             }
         }
+        __builtin_unreachable();
+    }
+
+    void N::setChild(N *cur, const uint8_t k, N *child) {
+        /* child is complete before a reader that does not lock can find it */
+        std::atomic_thread_fence(std::memory_order_release);
+        visit(cur, [k, child](auto n) { n->setChild(k, child); });
     }
 
     bool N::isFull() const {
@@ -103,47 +120,150 @@ namespace Index {
         return false;
     }
 
-    bool N::changeChild(N *cur, const uint8_t k, N *child) {
-        switch (cur->getType()) {
-            case NT4: {
-                auto n = static_cast<N4 *>(cur);
-                return n->changeChild(k, child);
-            }
-            case NT16: {
-                auto n = static_cast<N16 *>(cur);
-                return n->changeChild(k, child);
-            }
-            case NT48: {
-                auto n = static_cast<N48 *>(cur);
-                return n->changeChild(k, child);
-            }
-            case NT256: {
-                auto n = static_cast<N256 *>(cur);
-                return n->changeChild(k, child);
-            }
+    /* thresholds leave room for the removed child, so the smaller node is never full after shrinking */
+    bool N::isUnderFull() const {
+        switch (this->type_) {
+            case NT4:
+                return false;
+            case NT16:
+                return count_ == 3;
+            case NT48:
+                return count_ == 12;
+            case NT256:
+                return count_ == 37;
         }
         return false;
     }
 
-    void N::getChildren(const N* cur, const uint8_t start, const uint8_t end,
-                            std::tuple<uint8_t, N*>* const &children, uint16_t& len) {
-        switch (cur->getType()) {
-            case NT4: {
-                auto n = static_cast<const N4 *>(cur);
-                return n->getChildren(start, end, children, len);
-            }
-            case NT16: {
-                auto n = static_cast<const N16 *>(cur);
-                return n->getChildren(start, end, children, len);
-            }
-            case NT48: {
-                auto n = static_cast<const N48 *>(cur);
-                return n->getChildren(start, end, children, len);
+    void N::removeChild(N *cur, const uint8_t k) {
+        visit(cur, [k](auto n) { n->removeChild(k); });
+    }
+
+    bool N::hasTid(uint64_t value, TID tid) {
+        if (isTidPair(value)) {
+            return pairTid(value, 0) == tid || pairTid(value, 1) == tid;
+        }
+        if (!isTidList(value)) {
+            return value == tid;
+        }
+        auto list = getTidList(value);
+        return std::binary_search(list->tids, list->tids + list->count, tid);
+    }
+
+    void N::getTids(uint64_t value, vector<TID> &res) {
+        if (isTidPair(value)) {
+            res.push_back(pairTid(value, 0));
+            res.push_back(pairTid(value, 1));
+            return;
+        }
+        if (!isTidList(value)) {
+            res.push_back(value);
+            return;
+        }
+        auto list = getTidList(value);
+        res.insert(res.end(), list->tids, list->tids + list->count);
+    }
+
+    uint64_t N::addTid(uint64_t value, TID tid) {
+        if (hasTid(value, tid)) {
+            return value;
+        }
+        if (!hasSeveralTids(value)) {
+            uint64_t pair = makeTidPair(std::min(value, tid), std::max(value, tid));
+            if (isTidPair(pair)) {
+                return pair;
             }
-            case NT256: {
-                auto n = static_cast<const N256 *>(cur);
-                return n->getChildren(start, end, children, len);
+        }
+        /* the new list is the old TIDs with tid put in order */
+        TID inlineTids[2];
+        const TID *tids = inlineTids;
+        uint32_t count;
+        if (isTidList(value)) {
+            tids = getTidList(value)->tids;
+            count = getTidList(value)->count;
+        } else if (isTidPair(value)) {
+            inlineTids[0] = pairTid(value, 0);
+            inlineTids[1] = pairTid(value, 1);
+            count = 2;
+        } else {
+            inlineTids[0] = value;
+            count = 1;
+        }
+        auto pos = std::lower_bound(tids, tids + count, tid) - tids;
+        TidList *list = TidList::make(count + 1);
+        memcpy(list->tids, tids, pos * sizeof(TID));
+        list->tids[pos] = tid;
+        memcpy(list->tids + pos + 1, tids + pos, (count - pos) * sizeof(TID));
+        return uint64_t(list) | TID_LIST;
+    }
+
+    uint64_t N::removeTid(uint64_t value, TID tid) {
+        ASSERT(hasSeveralTids(value) && hasTid(value, tid), "removing the last TID removes the key");
+        if (isTidPair(value)) {
+            return pairTid(value, pairTid(value, 0) == tid);
+        }
+        auto old = getTidList(value);
+        auto pos = std::lower_bound(old->tids, old->tids + old->count, tid) - old->tids;
+        if (old->count == 2) {
+            return old->tids[1 - pos];
+        }
+        if (old->count == 3) {
+            TID a = old->tids[pos == 0], b = old->tids[pos == 2 ? 1 : 2];
+            uint64_t pair = makeTidPair(a, b);
+            if (isTidPair(pair)) {
+                return pair;
             }
         }
+        TidList *list = TidList::make(old->count - 1);
+        memcpy(list->tids, old->tids, pos * sizeof(TID));
+        memcpy(list->tids + pos, old->tids + pos + 1, (old->count - pos - 1) * sizeof(TID));
+        return uint64_t(list) | TID_LIST;
+    }
+
+    void N::releaseLeaf(N *leaf) {
+        uint64_t value = getValue(leaf);
+        if (isKeyLeaf(leaf)) {
+            KeyLeaf::release(getKeyLeaf(leaf));
+        }
+        if (isTidList(value)) {
+            TidList::release(getTidList(value));
+        }
+    }
+
+    size_t N::leafBytes(const N *leaf) {
+        uint64_t value = getValue(leaf);
+        size_t bytes = 0;
+        if (isKeyLeaf(leaf)) {
+            bytes += sizeof(KeyLeaf) + getKeyLeaf(leaf)->len;
+        }
+        if (isTidList(value)) {
+            bytes += sizeof(TidList) + getTidList(value)->count * sizeof(TID);
+        }
+        return bytes;
+    }
+
+    N *N::copyWithPrefix(N *cur, const uint8_t *prefix, uint8_t len, Index::ArtObjPool *pool) {
+        N *n = pool->newNode(static_cast<type>(cur->getType()));
+        n->setPrefix(prefix, len);
+        visit(cur, [n](auto src) { src->copyTo(static_cast<decltype(src)>(n)); });
+        return n;
+    }
+
+    bool N::changeChild(N *cur, const uint8_t k, N *child) {
+        std::atomic_thread_fence(std::memory_order_release);
+        return visit(cur, [k, child](auto n) { return n->changeChild(k, child); });
+    }
+
+    void N::getChildren(const N* cur, const uint8_t start, const uint8_t end,
+                            std::tuple<uint8_t, N*>* const &children, uint16_t& len) {
+        visit(cur, [&](auto n) { n->getChildren(start, end, children, len); });
+    }
+
+    N *N::getNextChild(const N *cur, const uint16_t start, uint8_t &k) {
+        return visit(cur, [start, &k](auto n) { return n->getNextChild(start, k); });
+    }
+
+    N *N::getPrevChild(const N *cur, const int16_t end, uint8_t &k) {
+        return visit(cur, [end, &k](auto n) { return n->getPrevChild(end, k); });
     }
-}
\ No newline at end of file
+}
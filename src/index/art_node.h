@@ -4,27 +4,131 @@
 #include <atomic>
 #include <cstring>
 #include <tuple>
+#include <algorithm>
 #include <emmintrin.h>
+#include <sched.h>
 #include <iostream>
+#include <new>
 
 #include "common/common.h"
 #include "index_defs.h"
+#include "art_node_scan.h"
+#include "art_arena.h"
 
 namespace Index {
 
     class ArtObjPool;
 
+    class N;
+
     const uint64_t LEAF = (1UL << 63);
 
+    /* set together with LEAF when the leaf points to a KeyLeaf instead of holding the TID, so TIDs keep below 2^62 */
+    const uint64_t KEY_LEAF = (1UL << 62);
+
+    /* set in a leaf's value when it points to a TidList instead of being the TID, so TIDs keep below 2^61 */
+    const uint64_t TID_LIST = (1UL << 61);
+
+    /* set together with TID_LIST when the value holds two TIDs below 2^30 inline instead of a pointer */
+    const uint64_t TID_PAIR = TID_LIST | (1UL << 60);
+
+    const uint64_t PAIR_TID_BITS = 30;
+
+    /* prefixes up to this length are kept inside the node, longer ones in a buffer the node owns */
     const uint16_t MAX_PREFIX_LEN = 8;
 
-    class N {
+    const size_t CACHE_LINE_SIZE = 64;
+
+    /* low bits of a child pointer holding the child's type, free since nodes are cache line aligned */
+    const uint64_t CHILD_TYPE = 0b11;
+    static_assert(NT256 <= CHILD_TYPE && CHILD_TYPE < CACHE_LINE_SIZE, "node type does not fit the pointer");
+
+#ifdef ART_ARENA_REFS
+    /**
+     * A child as the node types store it, 32 bits into NodeArena: an inner node is its line over
+     * the CHILD_TYPE bits, a leaf has REF_LEAF set and holds a TID below REF_CELL inline. Any
+     * other leaf (a larger TID, a TID_LIST or a KeyLeaf) is kept whole in an arena cell, REF_CELL
+     * set and the cell index in the remaining bits.
+     */
+    using Slot = uint32_t;
+
+    const uint32_t REF_LEAF = 1U << 31;
+
+    const uint32_t REF_CELL = 1U << 30;
+
+    static_assert(NodeArena::NODE_SPACE / NodeArena::LINE <= REF_LEAF >> 2, "line index does not fit a reference");
+    static_assert(NodeArena::CELL_SPACE / sizeof(uint64_t) <= REF_CELL, "cell index does not fit a reference");
+    static_assert(NodeArena::LINE == CACHE_LINE_SIZE, "arena lines are not cache lines");
+#else
+    /* a child as the node types store it, the pointer with its type tag */
+    using Slot = N *;
+#endif
+
+    /**
+     * Lazily expanded leaf: a key is hung as one leaf below the first node where it differs from
+     * every other key and keeps its whole key here, so the bytes that were never turned into
+     * nodes can still be compared. Only the value changes after creation, under the lock of the
+     * node pointing to it.
+     */
+    struct KeyLeaf {
+        uint64_t value; // as in an inline leaf: the TID or a TID_LIST
+        uint16_t len;
+        uint8_t key[0];
+
+        template<typename Key>
+        static KeyLeaf *make(const Key &k, uint64_t value) {
+            auto *leaf = static_cast<KeyLeaf *>(operator new(sizeof(KeyLeaf) + k.getKeyLen()));
+            leaf->value = value;
+            leaf->len = k.getKeyLen();
+            memcpy(leaf->key, &k[0], leaf->len);
+            return leaf;
+        }
+
+        static void release(KeyLeaf *leaf) {
+            operator delete(leaf);
+        }
+
+        template<typename Key>
+        bool match(const Key &k) const {
+            return len == k.getKeyLen() && memcmp(key, &k[0], len) == 0;
+        }
+    };
+
+    /**
+     * TIDs of a non-unique key, sorted. A key with a single TID keeps it in the leaf itself, and
+     * so does a key with two when both fit a TID_PAIR; only larger sets move here. Lists are never
+     * changed once reachable: adding or removing a TID installs a new list and retires the old one.
+     */
+    struct TidList {
+        uint32_t count;
+        TID tids[0];
+
+        static TidList *make(uint32_t count) {
+            auto *list = static_cast<TidList *>(operator new(sizeof(TidList) + count * sizeof(TID)));
+            list->count = count;
+            return list;
+        }
+
+        static void release(TidList *list) {
+            operator delete(list);
+        }
+    };
+
+    /**
+     * Nodes start on a cache line. The header is 20 bytes with the narrow fields last, and the
+     * node types lay their members out in its tail padding, so the key bytes of N4 and N16 share
+     * the first line with the lock and the prefix (see the size table below the node types).
+     */
+    class alignas(CACHE_LINE_SIZE) N {
     protected:
+        atomic<uint64_t> lock_{0b100};
+        union {
+            uint8_t prefix[MAX_PREFIX_LEN];
+            uint8_t *longPrefix_;   // pCount_ > MAX_PREFIX_LEN
+        };
         uint8_t pCount_ = 0;
         uint8_t type_;
         uint16_t count_ = 0; // child count
-        uint8_t prefix[8];
-        atomic<uint64_t> lock_{0b100};
 
     public:
         static bool isLeaf(const N *ptr) {
@@ -32,15 +136,148 @@ namespace Index {
             return (d & LEAF) == LEAF;
         }
 
-        static uint64_t getLeaf(const N *ptr) {
+        static bool isKeyLeaf(const N *ptr) {
+            uint64_t d = uint64_t(ptr);
+            return (d & (LEAF | KEY_LEAF)) == (LEAF | KEY_LEAF);
+        }
+
+        static KeyLeaf *getKeyLeaf(const N *ptr) {
+            return reinterpret_cast<KeyLeaf *>(uint64_t(ptr) & ~(LEAF | KEY_LEAF));
+        }
+
+        /* the TID of a leaf, the smallest one if the key has several */
+        static TID getLeaf(const N *ptr) {
+            return firstTid(getValue(ptr));
+        }
+
+        static uint64_t getValue(const N *ptr) {
+            if (isKeyLeaf(ptr)) {
+                return getKeyLeaf(ptr)->value;
+            }
             uint64_t d = uint64_t(ptr);
             return (d & ~LEAF);
         }
 
+        /* the key has more than one TID, inline as a pair or in a list */
+        static bool hasSeveralTids(uint64_t value) {
+            return (value & TID_LIST) == TID_LIST;
+        }
+
+        static bool isTidList(uint64_t value) {
+            return (value & TID_PAIR) == TID_LIST;
+        }
+
+        static bool isTidPair(uint64_t value) {
+            return (value & TID_PAIR) == TID_PAIR;
+        }
+
+        static TidList *getTidList(uint64_t value) {
+            return reinterpret_cast<TidList *>(value & ~TID_LIST);
+        }
+
+        /* the pair of a < b, or TID_LIST alone if either does not fit */
+        static uint64_t makeTidPair(TID a, TID b) {
+            if (b >> PAIR_TID_BITS) {
+                return TID_LIST;
+            }
+            return TID_PAIR | (b << PAIR_TID_BITS) | a;
+        }
+
+        static TID pairTid(uint64_t value, int i) {
+            return (value >> (i * PAIR_TID_BITS)) & ((1UL << PAIR_TID_BITS) - 1);
+        }
+
+        static TID firstTid(uint64_t value) {
+            if (isTidPair(value)) {
+                return pairTid(value, 0);
+            }
+            return isTidList(value) ? getTidList(value)->tids[0] : value;
+        }
+
+        static bool hasTid(uint64_t value, TID tid);
+
+        static void getTids(uint64_t value, vector<TID> &res);
+
+        /* a value with tid added or removed; value itself stays valid for concurrent readers */
+        static uint64_t addTid(uint64_t value, TID tid);
+
+        static uint64_t removeTid(uint64_t value, TID tid);
+
+        /* frees a removed leaf's KeyLeaf and TidList, it is the inline form for a list alone */
+        static void releaseLeaf(N *leaf);
+
+        /* what releaseLeaf would free, in bytes */
+        static size_t leafBytes(const N *leaf);
+
         static TID convertToLeaf(TID tid) {
             return tid | LEAF;
         }
 
+        static N *convertToLeaf(KeyLeaf *leaf) {
+            return reinterpret_cast<N *>(uint64_t(leaf) | LEAF | KEY_LEAF);
+        }
+
+        /**
+         * Node types store inner children with the child's type in the CHILD_TYPE bits, so a
+         * descent knows how to search the child before the child's header arrives. Leaves are
+         * stored as they are, their low bits belong to the TID. Only the node types and
+         * findSlot see slots: they tag on the way in and untag on the way out.
+         */
+#ifdef ART_ARENA_REFS
+        static Slot tagChild(N *child) {
+            if (child == nullptr) return 0;
+            if (isLeaf(child)) {
+                uint64_t value = uint64_t(child) & ~LEAF;
+                return value < REF_CELL ? REF_LEAF | Slot(value) : REF_LEAF | REF_CELL | NodeArena::newCell(uint64_t(child));
+            }
+            return NodeArena::lineOf(child) << 2 | child->getType();
+        }
+
+        static N *untagChild(Slot slot) {
+            if ((slot & REF_LEAF) == 0) {
+                return slot == 0 ? nullptr : static_cast<N *>(NodeArena::atLine(slot >> 2));
+            }
+            uint64_t word = (slot & REF_CELL) ? NodeArena::cellWord(slot & ~(REF_LEAF | REF_CELL))
+                                              : LEAF | (slot & ~REF_LEAF);
+            return reinterpret_cast<N *>(word);
+        }
+
+        /* a slot being overwritten or cleared gives its cell back, under the node's write lock */
+        static void releaseSlot(Slot slot) {
+            if ((slot & (REF_LEAF | REF_CELL)) == (REF_LEAF | REF_CELL)) {
+                NodeArena::freeCell(slot & ~(REF_LEAF | REF_CELL));
+            }
+        }
+
+        /* nodes are placed in the arena so their parents can name them by line */
+        static void *operator new(size_t size) { return NodeArena::allocNode(size); }
+
+        static void *operator new(size_t size, std::align_val_t) { return NodeArena::allocNode(size); }
+
+        static void *operator new(size_t, void *p) noexcept { return p; }
+
+        static void operator delete(void *p, size_t size) { NodeArena::freeNode(p, size); }
+
+        static void operator delete(void *p, size_t size, std::align_val_t) { NodeArena::freeNode(p, size); }
+#else
+        static Slot tagChild(N *child) {
+            if (child == nullptr || isLeaf(child)) return child;
+            return reinterpret_cast<N *>(uint64_t(child) | child->getType());
+        }
+
+        static N *untagChild(Slot slot) {
+            uint64_t d = uint64_t(slot);
+            return reinterpret_cast<N *>(isLeaf(slot) ? d : d & ~CHILD_TYPE);
+        }
+
+        static void releaseSlot(Slot slot) {}
+#endif
+
+        /* type of the inner child stored as slot */
+        static uint8_t childType(Slot slot) {
+            return uint64_t(slot) & CHILD_TYPE;
+        }
+
         void setType(uint8_t type) { this->type_ = type; }
 
         uint8_t getType() const { return this->type_; }
@@ -54,16 +291,31 @@ namespace Index {
         }
 
         const uint8_t *getPrefix() const {
-            return &prefix[0];
+            return pCount_ > MAX_PREFIX_LEN ? longPrefix_ : &prefix[0];
         }
 
+        /**
+         * Readers look at the prefix without holding the lock, so a node that is reachable may only
+         * switch between inline prefixes. Once a long prefix is set it stays until the node is
+         * reclaimed; changing it means replacing the node (see copyWithPrefix).
+         */
         void setPrefix(const uint8_t *c, uint8_t len) {
-            memcpy(this->prefix, c, len);
+            ASSERT(pCount_ <= MAX_PREFIX_LEN, "a long prefix is fixed for the life of the node");
+            if (len > MAX_PREFIX_LEN) {
+                longPrefix_ = new uint8_t[len];
+                memcpy(longPrefix_, c, len);
+            } else {
+                memcpy(this->prefix, c, len);
+            }
             this->pCount_ = len;
         }
 
-        void setPrefixLen(uint8_t len) {
-            this->pCount_ = len;
+        /* called once no reader can reach the node any more, see release */
+        void releasePrefix() {
+            if (pCount_ > MAX_PREFIX_LEN) {
+                delete[] longPrefix_;
+            }
+            pCount_ = 0;
         }
 
         bool isLocked(uint64_t version) const { return (version & LOCK) == LOCK; }
@@ -84,6 +336,9 @@ namespace Index {
 
         void writeUnlock() { lock_.fetch_add(0b10); }
 
+        /* gives the lock back at the version it was taken at, for a writer that ended up changing nothing */
+        void writeUnlockUnchanged() { lock_.fetch_sub(0b10); }
+
         uint64_t readLockOrRestart(bool &needRestart) const {
             uint64_t version = lock_.load();
             if (isLocked(version) || isObsolete(version)) {
@@ -104,24 +359,114 @@ namespace Index {
 
         void writeUnlockObsolete() { lock_.fetch_add(0b11); }
 
+        /**
+         * Pessimistic reader-writer latch on lock_, for ART_Lock, whose nodes never meet OLC
+         * readers. Readers are counted from LATCH_READER up; a writer takes the LOCK bit, which
+         * keeps new readers out, then waits for the ones inside to leave.
+         */
+        static const uint64_t LATCH_READER = 1ULL << 32;
+
+        void latchShared() {
+            for (int spins = 0;; spins++) {
+                uint64_t v = lock_.load(std::memory_order_relaxed);
+                if ((v & LOCK) == 0 && lock_.compare_exchange_weak(v, v + LATCH_READER, std::memory_order_acquire)) {
+                    return;
+                }
+                latchWait(spins);
+            }
+        }
+
+        void unlatchShared() { lock_.fetch_sub(LATCH_READER, std::memory_order_release); }
+
+        void latchExclusive() {
+            for (int spins = 0;; spins++) {
+                uint64_t v = lock_.load(std::memory_order_relaxed);
+                if ((v & LOCK) == 0 && lock_.compare_exchange_weak(v, v | LOCK, std::memory_order_acquire)) {
+                    break;
+                }
+                latchWait(spins);
+            }
+            for (int spins = 0; lock_.load(std::memory_order_acquire) >= LATCH_READER; spins++) {
+                latchWait(spins);
+            }
+        }
+
+        void unlatchExclusive() { lock_.fetch_and(~uint64_t(LOCK), std::memory_order_release); }
+
+        /* a shared latch turns exclusive if it is the only one and no writer waits, else it stays shared */
+        bool tryUpgradeLatch() {
+            uint64_t v = lock_.load(std::memory_order_relaxed);
+            return (v & LOCK) == 0 && (v >> 32) == 1 &&
+                   lock_.compare_exchange_strong(v, (v - LATCH_READER) | LOCK, std::memory_order_acquire);
+        }
+
+        static void latchWait(int spins) {
+            if (spins > 64)
+                sched_yield();
+            else
+                _mm_pause();
+        }
+
         static void insertAndGrow(N *n, N *parent, uint8_t pk, uint8_t key, N *new_node, ArtObjPool *pool);
 
         template<typename Small, typename Big>
         static void insertGrow(Small *small, Big *big, N *parent, uint8_t pk, uint8_t key, N *new_node);
 
+        static void removeAndShrink(N *n, N *parent, uint8_t pk, uint8_t key, ArtObjPool *pool);
+
+        template<typename Big, typename Small>
+        static void removeShrink(Big *big, Small *small, N *parent, uint8_t pk, uint8_t key);
+
+        /**
+         * Calls fn with n cast to its concrete node type. The type is switched on once, here, and
+         * fn is instantiated per node type, so whatever it calls on the node can be inlined.
+         */
+        template<typename Fn>
+        static decltype(auto) visit(const N *n, Fn &&fn);
+
+        template<typename Fn>
+        static decltype(auto) visit(N *n, Fn &&fn);
+
+        /* visit for a node whose type is already known, from the tag of the slot it was found in */
+        template<typename Fn>
+        static decltype(auto) visit(const N *n, uint8_t type, Fn &&fn);
+
+        /* getChild for descent loops, inlined into the caller through visit */
+        static N *findChild(const N *n, const uint8_t k);
+
+        /* findChild of a node of the given type, returning the child as stored, tag included */
+        static Slot findSlot(const N *n, uint8_t type, const uint8_t k);
+
         /* Node Common Interface */
-        static N *getChild(N *n, const uint8_t k);
+        static N *getChild(const N *n, const uint8_t k);
 
         static void setChild(N *n, const uint8_t k, N *child);
 
         static bool changeChild(N *n, const uint8_t k, N *child);
 
+        static void removeChild(N *n, const uint8_t k);
+
+        /* a node of the same type and children as n but with another prefix, n itself is left untouched */
+        static N *copyWithPrefix(N *n, const uint8_t *prefix, uint8_t len, ArtObjPool *pool);
+
         static void getChildren(const N* n, const uint8_t start, const uint8_t end,
                                 std::tuple<uint8_t, N*>* const &children, uint16_t& len);
 
+        /* first child with key byte >= start, nullptr if none */
+        static N *getNextChild(const N *n, const uint16_t start, uint8_t &k);
+
+        /* last child with key byte <= end, nullptr if none */
+        static N *getPrevChild(const N *n, const int16_t end, uint8_t &k);
+
         template<typename Node>
         void copyTo(Node *n);
 
+        /* frees what n owns once no reader can reach it: a long prefix and the cells of its leaves */
+        static void release(N *n);
+
+        /* release for a node that is not pooled, giving its memory back too */
+        static void deleteNode(N *n);
+
         bool isFull() const;
 
         bool isUnderFull() const;
@@ -129,27 +474,31 @@ namespace Index {
 
     class N4 : public N {
         uint8_t keys_[4];
-        N *children_[4];
+        Slot children_[4];
     public:
         N4() {
             this->type_ = NT4;
             std::memset(keys_, 0, 4);
-            std::memset(children_, 0, sizeof(N *) * 4);
+            std::memset(children_, 0, sizeof(Slot) * 4);
+        }
+
+        Slot getSlot(const uint8_t k) const {
+            int32_t keys;
+            memcpy(&keys, keys_, sizeof(keys));
+            __m128i cmp = _mm_cmpeq_epi8(_mm_set1_epi8(k), _mm_cvtsi32_si128(keys));
+            unsigned bitfield = _mm_movemask_epi8(cmp) & ((1 << count_) - 1);
+            return bitfield ? children_[__builtin_ctz(bitfield)] : Slot();
         }
 
         N *getChild(const uint8_t k) const {
-            for (int i = 0; i < count_; i++) {
-                if (keys_[i] == k) {
-                    return children_[i];
-                }
-            }
-            return nullptr;
+            return untagChild(getSlot(k));
         }
 
         bool changeChild(const uint8_t k, N *child) {
             for (int i = 0; i < count_; i++) {
                 if (keys_[i] == k) {
-                    children_[i] = child;
+                    releaseSlot(children_[i]);
+                    children_[i] = tagChild(child);
                     return true;
                 }
             }
@@ -160,16 +509,32 @@ namespace Index {
             uint8_t i;
             for (i = 0; (i < count_) && (keys_[i] < k); i++);
             memmove(keys_ + i + 1, keys_ + i, count_ - i);
-            memmove(children_ + i + 1, children_ + i, (count_ - i) * sizeof(N *));
+            memmove(children_ + i + 1, children_ + i, (count_ - i) * sizeof(Slot));
             keys_[i] = k;
-            children_[i] = child;
+            children_[i] = tagChild(child);
             count_++;
         }
 
+        void removeChild(const uint8_t k) {
+            for (int i = 0; i < count_; i++) {
+                if (keys_[i] == k) {
+                    releaseSlot(children_[i]);
+                    memmove(keys_ + i, keys_ + i + 1, count_ - i - 1);
+                    memmove(children_ + i, children_ + i + 1, (count_ - i - 1) * sizeof(Slot));
+                    count_--;
+                    return;
+                }
+            }
+        }
+
+        void releaseSlots() {
+            for (int i = 0; i < count_; i++) releaseSlot(children_[i]);
+        }
+
         template<typename N>
         void copyTo(N *n) {
             for (int i = 0; i < count_; i++) {
-                n->setChild(keys_[i], children_[i]);
+                n->setChild(keys_[i], untagChild(children_[i]));
             }
         }
 
@@ -177,15 +542,35 @@ namespace Index {
                          std::tuple<uint8_t, N*>* const &children, uint16_t &len) const {
             for (int i = 0; i < count_; i++) {
                 if (keys_[i] <= end && keys_[i] >= start) {
-                    children[len++] = std::make_tuple(keys_[i], children_[i]);
+                    children[len++] = std::make_tuple(keys_[i], untagChild(children_[i]));
+                }
+            }
+        }
+
+        N *getNextChild(const uint16_t start, uint8_t &k) const {
+            for (int i = 0; i < count_; i++) {
+                if (keys_[i] >= start) {
+                    k = keys_[i];
+                    return untagChild(children_[i]);
+                }
+            }
+            return nullptr;
+        }
+
+        N *getPrevChild(const int16_t end, uint8_t &k) const {
+            for (int i = count_ - 1; i >= 0; i--) {
+                if (keys_[i] <= end) {
+                    k = keys_[i];
+                    return untagChild(children_[i]);
                 }
             }
+            return nullptr;
         }
     };
 
     class N16 : public N {
         uint8_t keys_[16];
-        N *children_[16];
+        Slot children_[16];
 
         static uint8_t flipSign(uint8_t keyByte) {
             // Flip the sign bit, enables signed SSE comparison of unsigned values, used by Node16
@@ -210,24 +595,29 @@ namespace Index {
         N16() {
             this->type_ = NT16;
             std::memset(keys_, 0, 16);
-            std::memset(children_, 0, sizeof(N *) * 16);
+            std::memset(children_, 0, sizeof(Slot) * 16);
         }
 
-        N *getChild(const uint8_t k) const {
-            N *const *childPos = getChildPos(k);
+        Slot getSlot(const uint8_t k) const {
+            const Slot *childPos = getChildPos(k);
             if (childPos == nullptr) {
-                return nullptr;
+                return Slot();
             } else {
                 return *childPos;
             }
         }
 
+        N *getChild(const uint8_t k) const {
+            return untagChild(getSlot(k));
+        }
+
         bool changeChild(const uint8_t k, N *child) {
-            N **childPos = const_cast<N **>(getChildPos(k));
+            Slot *childPos = const_cast<Slot *>(getChildPos(k));
             if (childPos == nullptr) {
                 return false;
             } else {
-                *childPos = child;
+                releaseSlot(*childPos);
+                *childPos = tagChild(child);
                 return true;
             }
         }
@@ -239,13 +629,27 @@ namespace Index {
             uint16_t bitfield = _mm_movemask_epi8(cmp) & (0xFFFF >> (16 - count_));
             unsigned pos = bitfield ? ctz(bitfield) : count_;
             memmove(keys_ + pos + 1, keys_ + pos, count_ - pos);
-            memmove(children_ + pos + 1, children_ + pos, (count_ - pos) * sizeof(N *));
+            memmove(children_ + pos + 1, children_ + pos, (count_ - pos) * sizeof(Slot));
             keys_[pos] = keyByteFlipped;
-            children_[pos] = child;
+            children_[pos] = tagChild(child);
             count_++;
         }
 
-        N *const *getChildPos(const uint8_t k) const {
+        void removeChild(const uint8_t k) {
+            const Slot *childPos = getChildPos(k);
+            if (childPos == nullptr) return;
+            releaseSlot(*childPos);
+            auto pos = childPos - children_;
+            memmove(keys_ + pos, keys_ + pos + 1, count_ - pos - 1);
+            memmove(children_ + pos, children_ + pos + 1, (count_ - pos - 1) * sizeof(Slot));
+            count_--;
+        }
+
+        void releaseSlots() {
+            for (int i = 0; i < count_; i++) releaseSlot(children_[i]);
+        }
+
+        const Slot *getChildPos(const uint8_t k) const {
             __m128i cmp = _mm_cmpeq_epi8(_mm_set1_epi8(flipSign(k)),
                                          _mm_loadu_si128(reinterpret_cast<const __m128i *>(keys_)));
             unsigned bitfield = _mm_movemask_epi8(cmp) & ((1 << count_) - 1);
@@ -259,7 +663,7 @@ namespace Index {
         template<typename N>
         void copyTo(N *n) {
             for (int i = 0; i < count_; i++) {
-                n->setChild(flipSign(keys_[i]), children_[i]);
+                n->setChild(flipSign(keys_[i]), untagChild(children_[i]));
             }
         }
 
@@ -271,93 +675,264 @@ namespace Index {
             if (!end_pos) end_pos = children_ + (count_ - 1);
 
             for (auto p = start_pos; p <= end_pos; p++) {
-                children[len++] = std::make_tuple(flipSign(keys_[p - children_]), *p);
+                children[len++] = std::make_tuple(flipSign(keys_[p - children_]), untagChild(*p));
+            }
+        }
+
+        N *getNextChild(const uint16_t start, uint8_t &k) const {
+            for (int i = 0; i < count_; i++) {
+                if (flipSign(keys_[i]) >= start) {
+                    k = flipSign(keys_[i]);
+                    return untagChild(children_[i]);
+                }
+            }
+            return nullptr;
+        }
+
+        N *getPrevChild(const int16_t end, uint8_t &k) const {
+            for (int i = count_ - 1; i >= 0; i--) {
+                if (flipSign(keys_[i]) <= end) {
+                    k = flipSign(keys_[i]);
+                    return untagChild(children_[i]);
+                }
             }
+            return nullptr;
         }
     };
 
     class N48 : public N {
         uint8_t keys_[256];
-        N *children_[48];
+        Slot children_[48];
     public:
         static const uint8_t emptyMarker = 48;
 
         N48() {
             this->type_ = NT48;
             std::memset(keys_, emptyMarker, 256);
-            std::memset(children_, 0, sizeof(N *) * 48);
+            std::memset(children_, 0, sizeof(Slot) * 48);
+        }
+
+        Slot getSlot(const uint8_t k) const {
+            uint8_t pos = keys_[k];
+            return pos == emptyMarker ? Slot() : children_[pos];
         }
 
         N *getChild(const uint8_t k) const {
-            if (keys_[k] == emptyMarker) return nullptr;
-            else return children_[keys_[k]];
+            return untagChild(getSlot(k));
         }
 
         bool changeChild(const uint8_t k, N *child) {
             if (keys_[k] == emptyMarker) return false;
-            children_[keys_[k]] = child;
+            releaseSlot(children_[keys_[k]]);
+            children_[keys_[k]] = tagChild(child);
             return true;
         }
 
         void setChild(const uint8_t k, N *child) {
-            keys_[k] = count_;
-            children_[count_] = child;
+            // slots are no longer compact once a child has been removed
+            unsigned pos = count_;
+            if (children_[pos]) {
+                for (pos = 0; children_[pos]; pos++);
+            }
+            keys_[k] = pos;
+            children_[pos] = tagChild(child);
             count_++;
         }
 
+        void removeChild(const uint8_t k) {
+            if (keys_[k] == emptyMarker) return;
+            releaseSlot(children_[keys_[k]]);
+            children_[keys_[k]] = Slot();
+            keys_[k] = emptyMarker;
+            count_--;
+        }
+
+        /* removed children leave an empty slot behind, unlike in N4 and N16 */
+        void releaseSlots() {
+            for (Slot slot : children_) releaseSlot(slot);
+        }
+
         template<typename N>
         void copyTo(N *n) {
-            for (int i = 0; i < 256; i++) {
-                if (keys_[i] != emptyMarker)
-                    n->setChild(i, children_[keys_[i]]);
+            uint8_t k;
+            for (Index::N *child = getNextChild(0, k); child != nullptr; child = getNextChild(k + 1, k)) {
+                n->setChild(k, child);
             }
         }
 
         void getChildren(const uint8_t start, const uint8_t end,
                          std::tuple<uint8_t, N*>* const &children, uint16_t &len) const {
-            for (uint8_t k = start; k <= end; k++) {
-                if (keys_[k] != emptyMarker) {
-                    children[len++] = std::make_tuple(k, children_[keys_[k]]);
-                }
+            uint8_t k;
+            for (N *child = getNextChild(start, k); child != nullptr && k <= end; child = getNextChild(k + 1, k)) {
+                children[len++] = std::make_tuple(k, child);
             }
         }
+
+        /* keys_ is read once per slot, a racing writer may empty it but never sends us past children_ */
+        N *getNextChild(const uint16_t start, uint8_t &k) const {
+            uint16_t i = N48_SCAN->nextByte(keys_, emptyMarker, start);
+            if (i == 256) return nullptr;
+            uint8_t pos = keys_[i];
+            k = i;
+            return pos == emptyMarker ? nullptr : untagChild(children_[pos]);
+        }
+
+        N *getPrevChild(const int16_t end, uint8_t &k) const {
+            int16_t i = N48_SCAN->prevByte(keys_, emptyMarker, end);
+            if (i < 0) return nullptr;
+            uint8_t pos = keys_[i];
+            k = i;
+            return pos == emptyMarker ? nullptr : untagChild(children_[pos]);
+        }
     };
 
     class N256 : public N {
-        N *children_[256];
+        Slot children_[256];
+
+        static uint16_t nextUsed(N *const *slots, uint16_t start) { return N256_SCAN->nextPtr(slots, start); }
+
+        static uint16_t nextUsed(const uint32_t *slots, uint16_t start) { return N256_SCAN->nextRef(slots, start); }
+
+        static int16_t prevUsed(N *const *slots, int16_t end) { return N256_SCAN->prevPtr(slots, end); }
+
+        static int16_t prevUsed(const uint32_t *slots, int16_t end) { return N256_SCAN->prevRef(slots, end); }
     public:
         N256() {
             this->type_ = NT256;
-            std::memset(children_, 0, sizeof(N *) * 256);
+            std::memset(children_, 0, sizeof(Slot) * 256);
         }
 
-        N *getChild(const uint8_t k) const {
+        Slot getSlot(const uint8_t k) const {
             return children_[k];
         }
 
+        N *getChild(const uint8_t k) const {
+            return untagChild(getSlot(k));
+        }
+
         bool changeChild(const uint8_t k, N *child) {
-            children_[k] = child;
+            releaseSlot(children_[k]);
+            children_[k] = tagChild(child);
             return true;
         }
 
         void setChild(const uint8_t k, N *child) {
-            children_[k] = child;
+            children_[k] = tagChild(child);
             count_++;
         }
 
+        void removeChild(const uint8_t k) {
+            if (!children_[k]) return;
+            releaseSlot(children_[k]);
+            children_[k] = Slot();
+            count_--;
+        }
+
+        void releaseSlots() {
+            for (Slot slot : children_) releaseSlot(slot);
+        }
+
         template<typename N>
         void copyTo(N *n) {
-            for (int i = 0; i < 256; i++) {
-                n->setChild(i, children_[i]);
+            uint8_t k;
+            for (Index::N *child = getNextChild(0, k); child != nullptr; child = getNextChild(k + 1, k)) {
+                n->setChild(k, child);
             }
         }
 
         void getChildren(const uint8_t start, const uint8_t end,
                          std::tuple<uint8_t, N*>* const &children, uint16_t &len) const {
-            for (uint8_t k = start; k <= end; k++) {
-                if (children_[k])
-                    children[len++] = std::make_tuple(k, children_[k]);
+            uint8_t k;
+            for (N *child = getNextChild(start, k); child != nullptr && k <= end; child = getNextChild(k + 1, k)) {
+                children[len++] = std::make_tuple(k, child);
             }
         }
+
+        N *getNextChild(const uint16_t start, uint8_t &k) const {
+            uint16_t i = nextUsed(children_, start);
+            if (i == 256) return nullptr;
+            k = i;
+            return untagChild(children_[i]);
+        }
+
+        N *getPrevChild(const int16_t end, uint8_t &k) const {
+            int16_t i = prevUsed(children_, end);
+            if (i < 0) return nullptr;
+            k = i;
+            return untagChild(children_[i]);
+        }
     };
-}
\ No newline at end of file
+
+    /**
+     * Node sizes, bytes (cache lines): N4 64 (1), N16 192 (3), N48 704 (11), N256 2112 (33),
+     * with ART_ARENA_REFS N4 64 (1), N16 128 (2), N48 512 (8), N256 1088 (17).
+     * N4 and N16 only come out this small when their keys sit in the header's tail padding, at
+     * bytes 20 to 36, so a N4/N16 lookup reads the first line for the match and one line for
+     * the child. N48 and N256 read one line of keys_ or children_ besides the header.
+     */
+    static_assert(sizeof(N) == CACHE_LINE_SIZE, "node header outgrew a cache line");
+#ifdef ART_ARENA_REFS
+    static_assert(sizeof(N4) == 1 * CACHE_LINE_SIZE, "N4 keys no longer share the header line");
+    static_assert(sizeof(N16) == 2 * CACHE_LINE_SIZE, "N16 keys no longer share the header line");
+    static_assert(sizeof(N48) == 8 * CACHE_LINE_SIZE, "N48 layout changed");
+    static_assert(sizeof(N256) == 17 * CACHE_LINE_SIZE, "N256 layout changed");
+#else
+    static_assert(sizeof(N4) == 1 * CACHE_LINE_SIZE, "N4 keys no longer share the header line");
+    static_assert(sizeof(N16) == 3 * CACHE_LINE_SIZE, "N16 keys no longer share the header line");
+    static_assert(sizeof(N48) == 11 * CACHE_LINE_SIZE, "N48 layout changed");
+    static_assert(sizeof(N256) == 33 * CACHE_LINE_SIZE, "N256 layout changed");
+#endif
+
+    template<typename Fn>
+    inline decltype(auto) N::visit(const N *n, Fn &&fn) {
+        return visit(n, n->getType(), std::forward<Fn>(fn));
+    }
+
+    template<typename Fn>
+    inline decltype(auto) N::visit(const N *n, uint8_t type, Fn &&fn) {
+        switch (type) {
+            case NT4:
+                return fn(static_cast<const N4 *>(n));
+            case NT16:
+                return fn(static_cast<const N16 *>(n));
+            case NT48:
+                return fn(static_cast<const N48 *>(n));
+            case NT256:
+                return fn(static_cast<const N256 *>(n));
+        }
+        __builtin_unreachable();
+    }
+
+    template<typename Fn>
+    inline decltype(auto) N::visit(N *n, Fn &&fn) {
+        switch (n->getType()) {
+            case NT4:
+                return fn(static_cast<N4 *>(n));
+            case NT16:
+                return fn(static_cast<N16 *>(n));
+            case NT48:
+                return fn(static_cast<N48 *>(n));
+            case NT256:
+                return fn(static_cast<N256 *>(n));
+        }
+        __builtin_unreachable();
+    }
+
+    inline N *N::findChild(const N *n, const uint8_t k) {
+        return visit(n, [k](auto node) { return node->getChild(k); });
+    }
+
+    inline Slot N::findSlot(const N *n, uint8_t type, const uint8_t k) {
+        return visit(n, type, [k](auto node) { return node->getSlot(k); });
+    }
+
+    inline void N::release(N *n) {
+        n->releasePrefix();
+        visit(n, [](auto node) { node->releaseSlots(); });
+    }
+
+    inline void N::deleteNode(N *n) {
+        release(n);
+        visit(n, [](auto node) { delete node; });
+    }
+}
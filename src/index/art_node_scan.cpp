@@ -0,0 +1,87 @@
+#include <emmintrin.h>
+
+#include "art_node_scan.h"
+
+namespace Index {
+    extern const SlotScan AVX2_SLOT_SCAN;
+    extern const SlotScan AVX512_SLOT_SCAN;
+}
+
+namespace {
+    struct Isa {
+        static constexpr unsigned BYTE_BLOCK = 16;
+
+        static uint64_t usedBytes(const uint8_t *keys, uint8_t empty) {
+            __m128i cmp = _mm_cmpeq_epi8(_mm_loadu_si128(reinterpret_cast<const __m128i *>(keys)),
+                                         _mm_set1_epi8(empty));
+            return ~_mm_movemask_epi8(cmp) & 0xFFFF;
+        }
+
+        /* SSE2 has no 64-bit compare, a pointer is null when both its halves are */
+        static uint64_t usedPtrs(Index::N *const *slots) {
+            uint64_t null = 0;
+            for (int i = 0; i < 4; i++) {
+                __m128i cmp = _mm_cmpeq_epi32(_mm_loadu_si128(reinterpret_cast<const __m128i *>(slots + 2 * i)),
+                                              _mm_setzero_si128());
+                cmp = _mm_and_si128(cmp, _mm_shuffle_epi32(cmp, _MM_SHUFFLE(2, 3, 0, 1)));
+                null |= uint64_t(_mm_movemask_pd(_mm_castsi128_pd(cmp))) << (2 * i);
+            }
+            return ~null & 0xFF;
+        }
+
+        static uint64_t usedRefs(const uint32_t *slots) {
+            __m128i zero = _mm_setzero_si128();
+            __m128i cmp[4];
+            for (int i = 0; i < 4; i++) {
+                cmp[i] = _mm_cmpeq_epi32(_mm_loadu_si128(reinterpret_cast<const __m128i *>(slots + 4 * i)), zero);
+            }
+            /* packing keeps the all-ones and all-zeros lanes as they are, in slot order */
+            __m128i bytes = _mm_packs_epi16(_mm_packs_epi32(cmp[0], cmp[1]), _mm_packs_epi32(cmp[2], cmp[3]));
+            return ~_mm_movemask_epi8(bytes) & 0xFFFF;
+        }
+    };
+}
+
+#include "art_node_scan_impl.h"
+
+namespace Index {
+
+    extern const SlotScan SSE2_SLOT_SCAN = {"sse2", nextByte, prevByte, nextPtr, prevPtr, nextRef, prevRef};
+
+    bool slotScanSupported(ScanIsa isa) {
+        __builtin_cpu_init();
+        switch (isa) {
+            case ScanIsa::SSE2:
+                return true;
+            case ScanIsa::AVX2:
+                return __builtin_cpu_supports("avx2");
+            case ScanIsa::AVX512:
+                return __builtin_cpu_supports("avx512f") && __builtin_cpu_supports("avx512bw");
+        }
+        return false;
+    }
+
+    const SlotScan &slotScan(ScanIsa isa) {
+        switch (isa) {
+            case ScanIsa::AVX2:
+                return AVX2_SLOT_SCAN;
+            case ScanIsa::AVX512:
+                return AVX512_SLOT_SCAN;
+            default:
+                return SSE2_SLOT_SCAN;
+        }
+    }
+
+    const SlotScan *N48_SCAN = &SSE2_SLOT_SCAN;
+
+    /* starts out as SSE2 so it is usable from any static initializer, widened before those run */
+    const SlotScan *N256_SCAN = &SSE2_SLOT_SCAN;
+
+    __attribute__((constructor(101))) static void selectSlotScan() {
+        if (slotScanSupported(ScanIsa::AVX512)) {
+            N256_SCAN = &AVX512_SLOT_SCAN;
+        } else if (slotScanSupported(ScanIsa::AVX2)) {
+            N256_SCAN = &AVX2_SLOT_SCAN;
+        }
+    }
+}
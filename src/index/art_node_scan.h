@@ -0,0 +1,52 @@
+#pragma once
+
+#include <cstdint>
+
+namespace Index {
+
+    class N;
+
+    /**
+     * Slot scans over the 256-entry arrays of N48 (key bytes, emptyMarker when free) and N256
+     * (child pointers, nullptr when free, or 32-bit arena references, 0 when free, built with
+     * ART_ARENA_REFS), which range scans walk child by child. There is one
+     * implementation per instruction set, and one is picked per node type through cpuid when the
+     * library is loaded. SSE2 is always there on x86-64.
+     *
+     * The files implementing the wider ones are compiled for that instruction set and must not
+     * include art_node.h, or its inline functions could end up built with it.
+     */
+    struct SlotScan {
+        const char *isa;
+
+        /* first used slot >= start, 256 if none */
+        uint16_t (*nextByte)(const uint8_t *keys, uint8_t empty, uint16_t start);
+
+        /* last used slot <= end, -1 if none */
+        int16_t (*prevByte)(const uint8_t *keys, uint8_t empty, int16_t end);
+
+        uint16_t (*nextPtr)(N *const *slots, uint16_t start);
+
+        int16_t (*prevPtr)(N *const *slots, int16_t end);
+
+        uint16_t (*nextRef)(const uint32_t *slots, uint16_t start);
+
+        int16_t (*prevRef)(const uint32_t *slots, int16_t end);
+    };
+
+    enum class ScanIsa : uint8_t {
+        SSE2,
+        AVX2,
+        AVX512,
+    };
+
+    bool slotScanSupported(ScanIsa isa);
+
+    const SlotScan &slotScan(ScanIsa isa);
+
+    /* N48 byte scans stay on SSE2: a walk tests a block or two per child and wider loads only cost more */
+    extern const SlotScan *N48_SCAN;
+
+    /* N256 pointer and reference scans use the widest the CPU supports */
+    extern const SlotScan *N256_SCAN;
+}
@@ -0,0 +1,43 @@
+#include <immintrin.h>
+
+#include "art_node_scan.h"
+
+#pragma GCC target("avx2")
+
+namespace {
+    struct Isa {
+        static constexpr unsigned BYTE_BLOCK = 32;
+
+        static uint64_t usedBytes(const uint8_t *keys, uint8_t empty) {
+            __m256i cmp = _mm256_cmpeq_epi8(_mm256_loadu_si256(reinterpret_cast<const __m256i *>(keys)),
+                                            _mm256_set1_epi8(empty));
+            return ~uint32_t(_mm256_movemask_epi8(cmp));
+        }
+
+        static uint64_t usedPtrs(Index::N *const *slots) {
+            uint64_t null = 0;
+            for (int i = 0; i < 2; i++) {
+                __m256i cmp = _mm256_cmpeq_epi64(_mm256_loadu_si256(reinterpret_cast<const __m256i *>(slots + 4 * i)),
+                                                 _mm256_setzero_si256());
+                null |= uint64_t(_mm256_movemask_pd(_mm256_castsi256_pd(cmp))) << (4 * i);
+            }
+            return ~null & 0xFF;
+        }
+
+        static uint64_t usedRefs(const uint32_t *slots) {
+            uint64_t null = 0;
+            for (int i = 0; i < 2; i++) {
+                __m256i cmp = _mm256_cmpeq_epi32(_mm256_loadu_si256(reinterpret_cast<const __m256i *>(slots + 8 * i)),
+                                                 _mm256_setzero_si256());
+                null |= uint64_t(_mm256_movemask_ps(_mm256_castsi256_ps(cmp))) << (8 * i);
+            }
+            return ~null & 0xFFFF;
+        }
+    };
+}
+
+#include "art_node_scan_impl.h"
+
+namespace Index {
+    extern const SlotScan AVX2_SLOT_SCAN = {"avx2", nextByte, prevByte, nextPtr, prevPtr, nextRef, prevRef};
+}
@@ -0,0 +1,31 @@
+#include <immintrin.h>
+
+#include "art_node_scan.h"
+
+#pragma GCC target("avx512f,avx512bw")
+
+namespace {
+    struct Isa {
+        static constexpr unsigned BYTE_BLOCK = 64;
+
+        static uint64_t usedBytes(const uint8_t *keys, uint8_t empty) {
+            return _mm512_cmpneq_epi8_mask(_mm512_loadu_si512(keys), _mm512_set1_epi8(empty));
+        }
+
+        static uint64_t usedPtrs(Index::N *const *slots) {
+            __m512i v = _mm512_loadu_si512(slots);
+            return _mm512_test_epi64_mask(v, v);
+        }
+
+        static uint64_t usedRefs(const uint32_t *slots) {
+            __m512i v = _mm512_loadu_si512(slots);
+            return _mm512_test_epi32_mask(v, v);
+        }
+    };
+}
+
+#include "art_node_scan_impl.h"
+
+namespace Index {
+    extern const SlotScan AVX512_SLOT_SCAN = {"avx512", nextByte, prevByte, nextPtr, prevPtr, nextRef, prevRef};
+}
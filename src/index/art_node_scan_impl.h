@@ -0,0 +1,61 @@
+/**
+ * The scan loops behind SlotScan, shared by every instruction set. Only included by the
+ * art_node_scan*.cpp files, after they defined their `Isa`:
+ *   BYTE_BLOCK             key bytes tested at once (16, 32 or 64)
+ *   usedBytes(keys, empty) bit i set when keys[i] != empty, for BYTE_BLOCK bytes
+ *   usedPtrs(slots)        bit i set when slots[i] != nullptr, for 8 pointers
+ *   usedRefs(slots)        bit i set when slots[i] != 0, for 16 references
+ * Everything stays in the anonymous namespace so it is built with that file's target.
+ */
+
+namespace {
+
+    constexpr unsigned PTR_BLOCK = 8;
+
+    constexpr unsigned REF_BLOCK = 16;
+
+    template<unsigned BLOCK, typename Used>
+    inline uint16_t nextSlot(uint16_t start, Used used) {
+        for (unsigned b = start & ~(BLOCK - 1); b < 256; b += BLOCK) {
+            uint64_t m = used(b);
+            if (b < start) m &= ~0ULL << (start - b);
+            if (m) return b + __builtin_ctzll(m);
+        }
+        return 256;
+    }
+
+    template<unsigned BLOCK, typename Used>
+    inline int16_t prevSlot(int16_t end, Used used) {
+        if (end < 0) return -1;
+        for (int b = end & ~(BLOCK - 1); b >= 0; b -= BLOCK) {
+            uint64_t m = used(b);
+            if (b + int(BLOCK) - 1 > end) m &= ~0ULL >> (63 - (end - b));
+            if (m) return b + 63 - __builtin_clzll(m);
+        }
+        return -1;
+    }
+
+    uint16_t nextByte(const uint8_t *keys, uint8_t empty, uint16_t start) {
+        return nextSlot<Isa::BYTE_BLOCK>(start, [=](unsigned b) { return Isa::usedBytes(keys + b, empty); });
+    }
+
+    int16_t prevByte(const uint8_t *keys, uint8_t empty, int16_t end) {
+        return prevSlot<Isa::BYTE_BLOCK>(end, [=](unsigned b) { return Isa::usedBytes(keys + b, empty); });
+    }
+
+    uint16_t nextPtr(Index::N *const *slots, uint16_t start) {
+        return nextSlot<PTR_BLOCK>(start, [=](unsigned b) { return Isa::usedPtrs(slots + b); });
+    }
+
+    int16_t prevPtr(Index::N *const *slots, int16_t end) {
+        return prevSlot<PTR_BLOCK>(end, [=](unsigned b) { return Isa::usedPtrs(slots + b); });
+    }
+
+    uint16_t nextRef(const uint32_t *slots, uint16_t start) {
+        return nextSlot<REF_BLOCK>(start, [=](unsigned b) { return Isa::usedRefs(slots + b); });
+    }
+
+    int16_t prevRef(const uint32_t *slots, int16_t end) {
+        return prevSlot<REF_BLOCK>(end, [=](unsigned b) { return Isa::usedRefs(slots + b); });
+    }
+}
@@ -0,0 +1,177 @@
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#include <malloc.h>
+#include <cstdlib>
+#include <fstream>
+#include <string>
+#include <new>
+
+#include "art_obj_pool.h"
+
+namespace {
+    /* from linux/mempolicy.h, which is not always installed; the syscall needs no libnuma */
+    const int MPOL_PREFERRED_ = 1;
+}
+
+namespace Index {
+
+    int ArtObjPool::numaNodes() {
+        static const int nodes = [] {
+            /* a list like "0" or "0-3", the last number is the highest node */
+            std::ifstream online("/sys/devices/system/node/online");
+            std::string list;
+            if (!(online >> list)) {
+                return 1;
+            }
+            auto last = list.find_last_of(",-");
+            int highest = std::atoi(list.c_str() + (last == std::string::npos ? 0 : last + 1));
+            return highest + 1;
+        }();
+        return nodes;
+    }
+
+    ArtObjPool::~ArtObjPool() {
+        for (int t = NT4; t < TYPES; t++) {
+            for (auto &depot : depot_) {
+                Node *batch = batchOf(depot[t].load());
+                while (batch != nullptr) {
+                    Node *n = batch;
+                    batch = batch->nextBatch;
+                    while (n != nullptr) {
+                        Node *next = n->next;
+                        if (source_ == NodeSource::HEAP) deleteFree(type(t), n);
+                        n = next;
+                    }
+                }
+            }
+            for (auto &mags : local_) {
+                Magazine &mag = mags.of[t];
+                if (source_ == NodeSource::HEAP) {
+                    for (uint32_t i = 0; i < mag.count; i++) {
+                        deleteFree(type(t), mag.nodes[i]);
+                    }
+                }
+                mag.count = 0;
+            }
+        }
+        /* the nodes still in use went away with their trees, so what is left is only free nodes */
+        for (char *slab : slabs_) {
+            munmap(slab, SLAB_SIZE);
+        }
+    }
+
+    void *ArtObjPool::mapSlab(int node) {
+        void *slab = mapSlab();
+        if (numaNodes() > 1) {
+            /* only sets where the pages go once touched, so it has to come before carve writes to them */
+            unsigned long mask = 1UL << node;
+            syscall(SYS_mbind, slab, SLAB_SIZE, MPOL_PREFERRED_, &mask, sizeof(mask) * 8, 0);
+        }
+        return slab;
+    }
+
+    void *ArtObjPool::mapSlab() {
+        if (source_ == NodeSource::HUGE_SLAB) {
+            int flags = MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB;
+#ifdef MAP_HUGE_SHIFT
+            flags |= 21 << MAP_HUGE_SHIFT;  // 2 MB pages, whatever the system default size
+#endif
+            void *p = mmap(nullptr, SLAB_SIZE, PROT_READ | PROT_WRITE, flags, -1, 0);
+            if (p != MAP_FAILED) {
+                hugeTlbSlabs_++;
+                return p;
+            }
+        }
+        /* over-map and trim to a 2 MB boundary, transparent huge pages only back aligned ranges */
+        size_t len = 2 * SLAB_SIZE;
+        void *p = mmap(nullptr, len, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+        if (p == MAP_FAILED) {
+            throw std::bad_alloc();
+        }
+        char *start = static_cast<char *>(p);
+        char *slab = reinterpret_cast<char *>((uint64_t(start) + SLAB_SIZE - 1) & ~(SLAB_SIZE - 1));
+        if (slab > start) {
+            munmap(start, slab - start);
+        }
+        munmap(slab + SLAB_SIZE, start + len - (slab + SLAB_SIZE));
+        if (source_ == NodeSource::HUGE_SLAB) {
+            madvise(slab, SLAB_SIZE, MADV_HUGEPAGE);  // without THP this fails and the slab keeps normal pages
+        }
+        return slab;
+    }
+
+    void ArtObjPool::carve(int node, type t, Magazine &mag) {
+        size_t size = nodeSize(t);
+        std::lock_guard<std::mutex> guard(slabLock_);
+        char *&free = slabFree_[node][t], *&end = slabEnd_[node][t];
+        for (uint32_t i = 0; i < BATCH; i++) {
+            if (size_t(end - free) < size) {
+                char *slab = static_cast<char *>(mapSlab(node));
+                slabs_.push_back(slab);
+                free = slab;
+                end = slab + SLAB_SIZE;
+            }
+            mag.nodes[mag.count++] = reinterpret_cast<Node *>(free);
+            free += size;
+        }
+    }
+
+    void ArtObjPool::grow(int node, type t, Magazine &mag) {
+        if (source_ == NodeSource::HEAP) {
+            for (uint32_t i = 0; i < BATCH; i++) {
+                mag.nodes[mag.count++] = reinterpret_cast<Node *>(__newNode(t));
+            }
+        } else {
+            carve(node, t, mag);
+        }
+        size_t held = heldNodes_[t].fetch_add(BATCH, std::memory_order_relaxed) + BATCH;
+        heldBytes_.fetch_add(BATCH * nodeSize(t), std::memory_order_relaxed);
+        size_t peak = peakNodes_[t].load(std::memory_order_relaxed);
+        while (peak < held && !peakNodes_[t].compare_exchange_weak(peak, held, std::memory_order_relaxed));
+    }
+
+    NodeStats ArtObjPool::stats(type t) {
+        size_t free = depotNodes_[t].load(std::memory_order_relaxed);
+        for (auto &mags : local_) {
+            free += __atomic_load_n(&mags.of[t].count, __ATOMIC_RELAXED);
+        }
+        size_t held = heldNodes_[t].load(std::memory_order_relaxed);
+        size_t peak = peakNodes_[t].load(std::memory_order_relaxed);
+        free = std::min(free, held);
+        size_t size = nodeSize(t);
+        return {held - free, free, peak, (held - free) * size, free * size, peak * size};
+    }
+
+    size_t ArtObjPool::trim() {
+        if (source_ != NodeSource::HEAP) {
+            return 0;
+        }
+        size_t bytes = 0;
+        std::atomic<Node *> &hazard = local_.local().hazard;
+        for (int t = NT4; t < TYPES; t++) {
+            for (int node = 0; node < MAX_NUMA_NODES; node++) {
+                /* a batch some refill may still read goes back once the depot is empty */
+                std::vector<Magazine> kept;
+                Magazine batch;
+                while (refill(node, type(t), batch, hazard), batch.count > 0) {
+                    if (hazardous(batch.nodes, batch.count)) {
+                        kept.push_back(batch);
+                        batch.count = 0;
+                        continue;
+                    }
+                    bytes += batch.count * nodeSize(type(t));
+                    shrink(type(t), batch.count);
+                    while (batch.count > 0) {
+                        deleteFree(type(t), batch.nodes[--batch.count]);
+                    }
+                }
+                for (Magazine &mag : kept) {
+                    push(node, type(t), mag, mag.count);
+                }
+            }
+        }
+        malloc_trim(0);
+        return bytes;
+    }
+}
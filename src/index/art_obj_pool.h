@@ -1,6 +1,10 @@
 #pragma once
 
+#include <algorithm>
 #include <atomic>
+#include <mutex>
+#include <sched.h>
+#include "tbb/enumerable_thread_specific.h"
 
 #include "art_node.h"
 
@@ -8,48 +12,329 @@ namespace Index {
 
     struct Node {
         struct Node* next;
+        /* set on the first node of a batch in the depot: the batch below it */
+        struct Node* nextBatch;
     };
 
+    /* nodes and bytes of one node type in a pool, see ArtObjPool::stats */
+    struct NodeStats {
+        size_t liveNodes;   // in trees, or retired and waiting for their epoch
+        size_t freeNodes;   // in magazines and depots
+        size_t peakNodes;   // most ever held, live and free together
+        size_t liveBytes;
+        size_t freeBytes;
+        size_t peakBytes;
+    };
+
+    /* where a pool gets nodes from when it has no free ones of a type */
+    enum class NodeSource : uint8_t {
+        HEAP,       // one new per node
+        SLAB,       // carved from 2 MB slabs of one node type, unmapped all at once with the pool
+        HUGE_SLAB,  // SLAB on huge pages: reserved ones (MAP_HUGETLB), else transparent ones, else normal pages
+    };
+
+    /**
+     * Free nodes, per type. Each thread keeps its own magazine and only goes to the shared depot
+     * to take or hand back a whole batch, so newNode and gcNode on the insert path touch no
+     * shared cache line in the common case. A node freed by another thread than the one that
+     * took it simply joins that thread's magazine.
+     *
+     * Magazines of threads that have exited stay with the pool, at most 2 * BATCH nodes of each
+     * type per thread, and are freed with it.
+     *
+     * On a machine with several NUMA nodes the depots and slabs are kept per node, and a thread
+     * takes from those of the node it runs on; slabs are bound to their node before the first
+     * write, so fresh nodes are local to their first user. A freed node joins the free lists of
+     * the node its freeing thread runs on, which is usually where it came from. On one node all
+     * of this is node 0 and no policy is set. Heap nodes are left to the kernel's first-touch
+     * placement.
+     *
+     * The pool counts what it holds: nodes per type in batches as they come from the system and
+     * go back to it, and the KeyLeafs and TID lists of its trees, which its trees report. Free
+     * nodes beyond setFreeLimit and everything trim empties out go back to the heap; slab nodes
+     * only go with the pool. With setBudget, inserts that need memory fail once the pool holds the
+     * budget. A batch taken by an insert that passed the check just before may still go past it,
+     * by BATCH nodes of a type per thread at most.
+     *
+     * Trees take all their nodes from their pool and give them back to it when destroyed, so with
+     * slabs no node is ever freed on its own. Built with ART_ARENA_REFS the nodes have to live in
+     * NodeArena and the pool always uses HEAP, which then means the arena.
+     */
     class ArtObjPool {
     private:
-        std::atomic<Node*> list4_{nullptr};
-        std::atomic<Node*> list16_{nullptr};
-        std::atomic<Node*> list48_{nullptr};
-        std::atomic<Node*> list256_{nullptr};
+        static const uint32_t BATCH = 32;
+
+        static const size_t SLAB_SIZE = size_t(2) << 20;
+
+        static const int TYPES = NT256 + 1;
 
     public:
-        ~ArtObjPool() {
-            Node *head = nullptr;
-            uint64_t count = 0;
-            while ((head = list4_.load()) != nullptr) {
-                list4_.store(head->next);
-                delete (N4*)head;
-                count++;
+        /* nodes past this share the free lists of node % MAX_NUMA_NODES */
+        static const int MAX_NUMA_NODES = 8;
+
+        /* NUMA nodes of the machine, from sysfs; 1 where there is no NUMA */
+        static int numaNodes();
+
+        /* the NUMA node the calling thread runs on, an index below MAX_NUMA_NODES */
+        static int currentNumaNode() {
+            if (numaNodes() == 1) {
+                return 0;
+            }
+            unsigned cpu, node;
+            return getcpu(&cpu, &node) == 0 ? int(node % MAX_NUMA_NODES) : 0;
+        }
+
+    private:
+        struct Magazine {
+            Node *nodes[2 * BATCH];
+            uint32_t count = 0;
+        };
+
+        struct Magazines {
+            Magazine of[TYPES];
+            int node = 0;   // all of them hold nodes of this NUMA node
+            int64_t leafBytes = 0;  // not yet added to leafBytes_
+            std::atomic<Node *> hazard{nullptr};    // the depot batch refill is reading, see there
+        };
+
+        /**
+         * Stacks of batches of BATCH nodes. The top 16 bits of a head count its changes: a batch
+         * popped, reused and pushed again between another thread's load and CAS still fails
+         * that CAS, which a bare pointer head would not. The version does not keep the batch
+         * from being freed in between though, so refill announces the batch it reads in its
+         * hazard, and no node that is some thread's hazard goes back to the heap.
+         */
+        std::atomic<uint64_t> depot_[MAX_NUMA_NODES][TYPES] = {};
+
+        tbb::enumerable_thread_specific<Magazines> local_;
+
+        /* nodes held from the system and how many of them wait in depots, per type */
+        std::atomic<size_t> heldNodes_[TYPES] = {};
+        std::atomic<size_t> peakNodes_[TYPES] = {};
+        std::atomic<size_t> depotNodes_[TYPES] = {};
+
+        /* the bytes of heldNodes_ and of the leaves, the two parts of usedBytes */
+        std::atomic<size_t> heldBytes_{0};
+        std::atomic<int64_t> leafBytes_{0};
+
+        /* leaf bytes a thread counts on its own before adding them to leafBytes_ */
+        static const int64_t LEAF_BYTES_BATCH = 64 << 10;
+
+        std::atomic<size_t> freeLimit_{SIZE_MAX};
+        std::atomic<size_t> budget_{0};
+
+        const NodeSource source_;
+
+        /* the slabs being carved, per NUMA node and type, and all slabs for teardown; only touched by carve */
+        std::mutex slabLock_;
+        char *slabFree_[MAX_NUMA_NODES][TYPES] = {};
+        char *slabEnd_[MAX_NUMA_NODES][TYPES] = {};
+        std::vector<char *> slabs_;
+        size_t hugeTlbSlabs_ = 0;
+
+        void *mapSlab();
+
+        /* with several NUMA nodes, one whose pages are placed on node as they are first written */
+        void *mapSlab(int node);
+
+        /* fills mag, which is empty, with BATCH fresh nodes of type t from its slab on node */
+        void carve(int node, type t, Magazine &mag);
+
+        /* fills mag, which is empty, with BATCH nodes of type t new from the system */
+        void grow(int node, type t, Magazine &mag);
+
+        /* n nodes of type t went back to the system */
+        void shrink(type t, size_t n) {
+            heldNodes_[t].fetch_sub(n, std::memory_order_relaxed);
+            heldBytes_.fetch_sub(n * nodeSize(t), std::memory_order_relaxed);
+        }
+
+        void addLeafBytes(int64_t bytes) {
+            int64_t &local = local_.local().leafBytes;
+            local += bytes;
+            if (local >= LEAF_BYTES_BATCH || local <= -LEAF_BYTES_BATCH) {
+                leafBytes_.fetch_add(local, std::memory_order_relaxed);
+                local = 0;
             }
-            cout << count << endl;
-            count = 0;
-            while ((head = list16_.load()) != nullptr) {
-                list16_.store(head->next);
-                delete (N16*)head;
-                count++;
+        }
+
+        /* the magazines of the calling thread, handing back those of the node it ran on before */
+        Magazines &magazines() {
+            Magazines &mags = local_.local();
+            int node = currentNumaNode();
+            if (mags.node != node) { /* the thread moved, its nodes go back to where they live */
+                for (int t = NT4; t < TYPES; t++) {
+                    Magazine &mag = mags.of[t];
+                    while (mag.count > 0) {
+                        flush(mags.node, type(t), mag, mag.count < BATCH ? mag.count : BATCH);
+                    }
+                }
+                mags.node = node;
             }
-            cout << count << endl;
-            count = 0;
-            while ((head = list48_.load()) != nullptr) {
-                list48_.store(head->next);
-                delete (N48*)head;
-                count++;
+            return mags;
+        }
+
+        static const int VERSION_SHIFT = 48;
+
+        static Node *batchOf(uint64_t head) {
+            return reinterpret_cast<Node *>(head & ((1ULL << VERSION_SHIFT) - 1));
+        }
+
+        static uint64_t nextHead(uint64_t head, Node *batch) {
+            return ((head >> VERSION_SHIFT) + 1) << VERSION_SHIFT | uint64_t(batch);
+        }
+
+        /* moves a batch from the depot of node into mag, which is empty; hazard is the calling thread's */
+        void refill(int node, type t, Magazine &mag, std::atomic<Node *> &hazard) {
+            std::atomic<uint64_t> &depot = depot_[node][t];
+            uint64_t head = depot.load(std::memory_order_acquire);
+            while (batchOf(head) != nullptr) {
+                /* once head is read another thread may take the batch and free it, it is only safe to
+                 * read once it is our hazard and still the head; a stale nextBatch then fails the CAS */
+                hazard.store(batchOf(head), std::memory_order_seq_cst);
+                uint64_t again = depot.load(std::memory_order_seq_cst);
+                if (again != head) {
+                    head = again;
+                    continue;
+                }
+                Node *next = batchOf(head)->nextBatch;
+                if (depot.compare_exchange_weak(head, nextHead(head, next), std::memory_order_seq_cst)) {
+                    hazard.store(nullptr, std::memory_order_release);
+                    uint32_t count = mag.count;
+                    for (Node *n = batchOf(head); n != nullptr; n = n->next) {
+                        mag.nodes[mag.count++] = n;
+                    }
+                    depotNodes_[t].fetch_sub(mag.count - count, std::memory_order_relaxed);
+                    return;
+                }
             }
-            cout << count << endl;
-            count = 0;
-            while ((head = list256_.load()) != nullptr) {
-                list256_.store(head->next);
-                delete (N256*)head;
-                count++;
+            hazard.store(nullptr, std::memory_order_release);
+        }
+
+        /* some refill may be reading one of the n nodes */
+        bool hazardous(Node *const *nodes, uint32_t n) {
+            for (auto &mags : local_) {
+                Node *hazard = mags.hazard.load(std::memory_order_seq_cst);
+                if (hazard != nullptr && std::find(nodes, nodes + n, hazard) != nodes + n) {
+                    return true;
+                }
+            }
+            return false;
+        }
+
+        /* pushes the top n nodes of mag, at most BATCH, onto the depot of node as one batch */
+        void push(int node, type t, Magazine &mag, uint32_t n) {
+            depotNodes_[t].fetch_add(n, std::memory_order_relaxed);
+            std::atomic<uint64_t> &depot = depot_[node][t];
+            Node *batch = nullptr;
+            for (uint32_t i = 0; i < n; i++) {
+                Node *n = mag.nodes[--mag.count];
+                n->next = batch;
+                batch = n;
             }
-            cout << count << endl;
+            uint64_t head = depot.load(std::memory_order_relaxed);
+            do {
+                batch->nextBatch = batchOf(head);
+            } while (!depot.compare_exchange_weak(head, nextHead(head, batch), std::memory_order_release));
         }
 
+        /* moves the top n nodes of mag, at most BATCH, to the depot of node, or to the system past
+         * freeLimit_ unless a refill may still read one of them */
+        void flush(int node, type t, Magazine &mag, uint32_t n) {
+            if (source_ == NodeSource::HEAP && freeBytes() + n * nodeSize(t) > freeLimit_.load(std::memory_order_relaxed)
+                && !hazardous(mag.nodes + mag.count - n, n)) {
+                for (uint32_t i = 0; i < n; i++) {
+                    deleteFree(t, mag.nodes[--mag.count]);
+                }
+                shrink(t, n);
+                return;
+            }
+            push(node, t, mag, n);
+        }
+
+        static size_t nodeSize(type t) {
+            switch (t) {
+                case NT4: return sizeof(N4);
+                case NT16: return sizeof(N16);
+                case NT48: return sizeof(N48);
+                case NT256: return sizeof(N256);
+            }
+            return 0;
+        }
+
+        /* bytes of the nodes in depots, those in magazines are bounded by the threads */
+        size_t freeBytes() const {
+            size_t bytes = 0;
+            for (int t = NT4; t < TYPES; t++) {
+                bytes += depotNodes_[t].load(std::memory_order_relaxed) * nodeSize(type(t));
+            }
+            return bytes;
+        }
+
+        static void deleteFree(type t, Node *n) {
+            switch (t) {
+                case NT4: delete (N4 *) n; break;
+                case NT16: delete (N16 *) n; break;
+                case NT48: delete (N48 *) n; break;
+                case NT256: delete (N256 *) n; break;
+            }
+        }
+
+    public:
+        explicit ArtObjPool(NodeSource source = NodeSource::HEAP)
+#ifdef ART_ARENA_REFS
+                : source_(NodeSource::HEAP) {}
+#else
+                : source_(source) {}
+#endif
+
+        ~ArtObjPool();
+
+        NodeSource source() const {
+            return source_;
+        }
+
+        /* slabs mapped so far, and how many of them on reserved huge pages */
+        size_t slabCount() {
+            std::lock_guard<std::mutex> guard(slabLock_);
+            return slabs_.size();
+        }
+
+        size_t hugeTlbSlabCount() {
+            std::lock_guard<std::mutex> guard(slabLock_);
+            return hugeTlbSlabs_;
+        }
+
+        /* a snapshot that may be a little off while other threads take and give back nodes */
+        NodeStats stats(type t);
+
+        /* bytes of nodes held from the system and of the leaves of the trees */
+        size_t usedBytes() const {
+            int64_t leaves = leafBytes_.load(std::memory_order_relaxed);
+            return heldBytes_.load(std::memory_order_relaxed) + (leaves > 0 ? leaves : 0);
+        }
+
+        /* free nodes kept in depots, in bytes; more go back to the heap as they are freed */
+        void setFreeLimit(size_t bytes) { freeLimit_.store(bytes); }
+
+        /* usedBytes at which inserts start to fail, 0 for none */
+        void setBudget(size_t bytes) { budget_.store(bytes); }
+
+        bool overBudget() const {
+            size_t budget = budget_.load(std::memory_order_relaxed);
+            return budget != 0 && usedBytes() >= budget;
+        }
+
+        /* gives the nodes in depots back to the heap and the heap's free pages to the system, returns the bytes */
+        size_t trim();
+
+        /* the trees of the pool report their KeyLeafs and TID lists here */
+        void leafAllocated(size_t bytes) { addLeafBytes(int64_t(bytes)); }
+
+        void leafFreed(size_t bytes) { addLeafBytes(-int64_t(bytes)); }
+
+        /* every node type is alignas(CACHE_LINE_SIZE), new and delete use the aligned operators for them,
+         * or place the node in NodeArena when built with ART_ARENA_REFS */
         N* __newNode(type t) {
             switch (t) {
                 case NT4: return new N4();
@@ -61,68 +346,33 @@ namespace Index {
         }
 
         N* newNode(type t) {
-            Node *head = nullptr;
+            Magazines &mags = magazines();
+            Magazine &mag = mags.of[t];
+            if (mag.count == 0) {
+                refill(mags.node, t, mag, mags.hazard);
+            }
+            if (mag.count == 0) {
+                grow(mags.node, t, mag);
+            }
+            Node *head = mag.nodes[--mag.count];
             switch (t) {
-                case NT4: {
-                    do {
-                        head = list4_.load(std::memory_order_relaxed);
-                    } while (head && !list4_.compare_exchange_weak(head, head->next, std::memory_order_relaxed));
-                    if (head) return new(head) N4;
-                    break;
-                }
-                case NT16: {
-                    do {
-                        head = list16_.load(std::memory_order_relaxed);
-                    } while (head && !list16_.compare_exchange_weak(head, head->next, std::memory_order_relaxed));
-                    if (head) return new(head) N16;
-                    break;
-                }
-                case NT48: {
-                    do {
-                        head = list48_.load(std::memory_order_relaxed);
-                    } while (head && !list48_.compare_exchange_weak(head, head->next, std::memory_order_relaxed));
-                    if (head) return new(head) N48;
-                    break;
-                }
-                case NT256: {
-                    do {
-                        head = list256_.load(std::memory_order_relaxed);
-                    } while (head && !list256_.compare_exchange_weak(head, head->next, std::memory_order_relaxed));
-                    if (head) return new(head) N256;
-                    break;
-                }
+                case NT4: return new(head) N4;
+                case NT16: return new(head) N16;
+                case NT48: return new(head) N48;
+                case NT256: return new(head) N256;
             }
-            return __newNode(t);
+            return nullptr;
         }
 
         void gcNode(N* n) {
-            Node* head = reinterpret_cast<Node*>(n);
-            switch (n->getType()) {
-                case NT4: {
-                    do {
-                        head->next = list4_.load(std::memory_order_relaxed);
-                    } while (!list4_.compare_exchange_weak(head->next, head, std::memory_order_relaxed));
-                    break;
-                }
-                case NT16: {
-                    do {
-                        head->next = list16_.load(std::memory_order_relaxed);
-                    } while (!list16_.compare_exchange_weak(head->next, head, std::memory_order_relaxed));
-                    break;
-                }
-                case NT48: {
-                    do {
-                        head->next = list48_.load(std::memory_order_relaxed);
-                    } while (!list48_.compare_exchange_weak(head->next, head, std::memory_order_relaxed));
-                    break;
-                }
-                case NT256: {
-                    do {
-                        head->next = list256_.load(std::memory_order_relaxed);
-                    } while (!list256_.compare_exchange_weak(head->next, head, std::memory_order_relaxed));
-                    break;
-                }
+            N::release(n);
+            auto t = static_cast<type>(n->getType());
+            Magazines &mags = magazines();
+            Magazine &mag = mags.of[t];
+            if (mag.count == 2 * BATCH) {
+                flush(mags.node, t, mag, BATCH);
             }
+            mag.nodes[mag.count++] = reinterpret_cast<Node *>(n);
         }
     };
 }
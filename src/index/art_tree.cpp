@@ -79,31 +79,175 @@ namespace Index {
 #define DELETE_UNLOCK(node) \
         (node)->writeUnlockObsolete();
 
+#define UNCHANGED_UNLOCK(node) \
+        (node)->writeUnlockUnchanged();
+
+    static const size_t START_GC_THRESHOLD = 256;
+
+    static const size_t LOOKUP_BATCH_INFLIGHT = 16;
+
     template<uint16_t KeyLen>
-    ART<KeyLen>::ART(Index::ArtObjPool *art_obj_pool) {
-        root_ = new N256();
+    ART<KeyLen>::ART(Index::ArtObjPool *art_obj_pool) : epoch_(START_GC_THRESHOLD, art_obj_pool) {
         art_obj_pool_ = art_obj_pool;
+        root_ = art_obj_pool_->newNode(NT256);
     }
 
     template<uint16_t KeyLen>
     ART<KeyLen>::~ART() {
-        //GC(root_);
+        for (auto &r : replicas_) {
+            if (r.root.load() != nullptr) {
+                dropReplica(r.root.load(), 0, nullptr);
+            }
+        }
+        GC(root_);
+    }
+
+    template<uint16_t KeyLen>
+    void ART<KeyLen>::replicateUpperLevels(uint16_t levels) {
+        for (auto &r : replicas_) {
+            if (r.root.load() != nullptr) {
+                dropReplica(r.root.load(), 0, nullptr);
+            }
+            r.root.store(nullptr);
+            r.version.store(STALE);
+        }
+        replicatedLevels_ = levels;
+    }
+
+    template<uint16_t KeyLen>
+    void ART<KeyLen>::setSyncMode(SyncMode mode) {
+#ifndef ART_ARENA_REFS
+        sync_ = mode;
+#endif
+    }
+
+    template<uint16_t KeyLen>
+    N *ART<KeyLen>::startNode(uint64_t &version) const {
+        version = STALE;
+        if (replicatedLevels_ == 0) {
+            return root_;
+        }
+        Replica &r = replicas_[ArtObjPool::currentNumaNode()];
+        uint64_t upper = upperVersion_.load(std::memory_order_acquire);
+        uint64_t v = r.version.load(std::memory_order_acquire);
+        N *root = r.root.load(std::memory_order_acquire);
+        /* a new replica is published as STALE, root, version; seeing the same version around root pairs them */
+        if (v == upper && r.version.load(std::memory_order_acquire) == v) {
+            version = v;
+            return root;
+        }
+        if ((upper & (UPPER_WRITE - 1)) != 0 || r.building.exchange(true, std::memory_order_acquire)) {
+            return root_;
+        }
+
+        N *copy = nullptr;
+        bool ok = copyUpper(root_, 0, copy);
+        std::atomic_thread_fence(std::memory_order_acquire);
+        if (ok && upperVersion_.load(std::memory_order_relaxed) != upper) { /* copied across an upper write */
+            dropReplica(copy, 0, nullptr);
+            ok = false;
+        }
+        if (ok) {
+            r.version.store(STALE);
+            N *old = r.root.exchange(copy);
+            r.version.store(upper);
+            replicaBuilds_++;
+            if (old != nullptr) {
+                ThreadInfo ti(epoch_);
+                dropReplica(old, 0, &ti);
+            }
+        }
+        r.building.store(false, std::memory_order_release);
+        if (!ok) {
+            return root_;
+        }
+        version = upper;
+        return copy;
+    }
+
+    template<uint16_t KeyLen>
+    bool ART<KeyLen>::copyUpper(const N *n, uint16_t depth, N *&copy) const {
+        N *src = const_cast<N *>(n);
+        bool needRestart = false;
+        uint64_t v = src->readLockOrRestart(needRestart);
+        if (!needRestart) {
+            src->upgradeToWriteLockOrRestart(v, needRestart);
+        }
+        if (needRestart) {
+            return false;
+        }
+        /* copied under the lock, which is given back at the same version, so readers of src go on */
+        copy = N::copyWithPrefix(src, src->getPrefix(), src->getPrefixLen(), art_obj_pool_);
+        src->writeUnlockUnchanged();
+        if (depth + 1 >= replicatedLevels_) { /* the children are the shared nodes below the replica */
+            return true;
+        }
+
+        std::tuple<uint8_t, N *> children[256];
+        uint16_t len = 0;
+        N::getChildren(copy, 0, 255, children, len);
+        for (uint16_t i = 0; i < len; i++) {
+            auto [k, child] = children[i];
+            if (N::isLeaf(child)) {
+                continue;
+            }
+            N *sub;
+            if (!copyUpper(child, depth + 1, sub)) {
+                /* the children before i are copies already, the others still the shared nodes */
+                for (uint16_t j = 0; j < i; j++) {
+                    if (!N::isLeaf(std::get<1>(children[j]))) {
+                        dropReplica(N::getChild(copy, std::get<0>(children[j])), depth + 1, nullptr);
+                    }
+                }
+                art_obj_pool_->gcNode(copy);
+                return false;
+            }
+            N::changeChild(copy, k, sub);
+        }
+        return true;
+    }
+
+    template<uint16_t KeyLen>
+    void ART<KeyLen>::dropReplica(N *copy, uint16_t depth, ThreadInfo *ti) const {
+        if (depth + 1 < replicatedLevels_) {
+            std::tuple<uint8_t, N *> children[256];
+            uint16_t len = 0;
+            N::getChildren(copy, 0, 255, children, len);
+            for (uint16_t i = 0; i < len; i++) {
+                if (!N::isLeaf(std::get<1>(children[i]))) {
+                    dropReplica(std::get<1>(children[i]), depth + 1, ti);
+                }
+            }
+        }
+        if (ti != nullptr) {
+            epoch_.markNodeForDeletion(copy, *ti);
+        } else {
+            art_obj_pool_->gcNode(copy);
+        }
     }
 
     template<uint16_t KeyLen>
     void ART<KeyLen>::GC(N* n) {
         if (N::isLeaf(n)) return ;
         std::tuple<uint8_t, N*> children[256];
-        uint16_t len;
+        uint16_t len = 0;
 
         N::getChildren(n, 0, 255, children, len);
         for (uint16_t i = 0; i < len; i++) {
             auto node = std::get<1>(children[i]);
             if (!N::isLeaf(node)) {
                 GC(node);
+            } else {
+                art_obj_pool_->leafFreed(N::leafBytes(node));
+                N::releaseLeaf(node);
             }
         }
-        delete n;
+        art_obj_pool_->gcNode(n);
+    }
+
+    template<uint16_t KeyLen>
+    void ART<KeyLen>::retireNode(N *n, ThreadInfo &ti) {
+        epoch_.markNodeForDeletion(n, ti);
     }
 
     template<uint16_t KeyLen>
@@ -115,7 +259,7 @@ namespace Index {
     }
 
     template<uint16_t KeyLen>
-    bool ART<KeyLen>::lookup(const Key &key, TID &tid) const {
+    N *ART<KeyLen>::findLeaf(const Key &key) const {
         int restartCount = 0;
         restart:
         if (restartCount++) {
@@ -125,150 +269,457 @@ namespace Index {
 
         N *cur;
         N *parent = nullptr;
-        uint64_t v, nv;
-        uint16_t level = 0;
+        uint64_t v, nv, start;
+        uint16_t level = 0, depth = 0;
 
-        cur = root_;
+        cur = startNode(start);
         READ_LOCK(cur, v, needRestart)
         while (key.getKeyLen() > level) {
             if (checkPrefix(cur, key, level)) { // MATCH
                 parent = cur;
-                cur = N::getChild(cur, key[level]);
+                cur = N::findChild(cur, key[level]);
                 READ_UNLOCK(parent, v, needRestart)
 
                 if (cur == nullptr) {
-                    return false;
+                    return nullptr;
                 }
-                if (N::isLeaf(cur) && level == key.getKeyLen() - 1) {
-                    READ_UNLOCK(parent, v, needRestart)
-                    tid = N::getLeaf(cur);
-                    return true;
+                if (N::isLeaf(cur)) {
+                    /* a KeyLeaf may sit above the last byte, the bytes below it were never compared */
+                    if (N::isKeyLeaf(cur) ? !N::getKeyLeaf(cur)->match(key) : level != key.getKeyLen() - 1) {
+                        return nullptr;
+                    }
+                    return cur;
                 }
             } else {   // NO MATCH
                 READ_UNLOCK(cur, v, needRestart)
-                return false;
+                return nullptr;
             }
             level++;
 
             READ_LOCK(cur, nv, needRestart)
+            if (++depth == replicatedLevels_ && start != STALE &&
+                upperVersion_.load(std::memory_order_acquire) != start) { /* the replica above cur went stale */
+                goto restart;
+            }
             READ_UNLOCK(parent, v, needRestart)
             v = nv;
         }
-        return false;
+        return nullptr;
     }
 
     template<uint16_t KeyLen>
-    bool ART<KeyLen>::lookupRange(const Key &k1, const Key &k2, vector<TID> &res) {
-
-        std::function<void(const N*)> copy = [&](const N* cur) {
-            if (N::isLeaf(cur)) {
-                res.push_back(N::getLeaf(cur));
-            } else {
-                std::tuple<uint8_t, N*> children[256];
-                uint16_t len;
-
-                N::getChildren(cur, 0, 255, children, len);
-                for (uint16_t i = 0; i < len; i++) {
-                    const N* n = std::get<1>(children[i]);
-                    copy(n);
+    N *ART<KeyLen>::findLeafWaitFree(const Key &key) const {
+        /* whatever node this reaches is complete and keeps its prefix, at worst it was replaced meanwhile */
+        const N *cur = root_;
+        uint16_t level = 0;
+        while (key.getKeyLen() > level) {
+            if (!checkPrefix(cur, key, level)) {
+                return nullptr;
+            }
+            N *next = N::findChild(cur, key[level]);
+            if (next == nullptr) {
+                return nullptr;
+            }
+            if (N::isLeaf(next)) {
+                if (N::isKeyLeaf(next) ? !N::getKeyLeaf(next)->match(key) : level != key.getKeyLen() - 1) {
+                    return nullptr;
                 }
+                return next;
             }
+            cur = next;
+            level++;
+        }
+        return nullptr;
+    }
+
+    template<uint16_t KeyLen>
+    bool ART<KeyLen>::lookup(const Key &key, TID &tid) const {
+        ThreadInfo ti(epoch_);
+        EpochGuard guard(ti);
+
+        N *leaf = sync_ == SyncMode::ROWEX ? findLeafWaitFree(key) : findLeaf(key);
+        if (leaf == nullptr) {
+            return false;
+        }
+        tid = N::getLeaf(leaf);
+        return true;
+    }
+
+    template<uint16_t KeyLen>
+    bool ART<KeyLen>::lookupAll(const Key &key, vector<TID> &res) const {
+        ThreadInfo ti(epoch_);
+        EpochGuard guard(ti);
+
+        N *leaf = sync_ == SyncMode::ROWEX ? findLeafWaitFree(key) : findLeaf(key);
+        if (leaf == nullptr) {
+            return false;
+        }
+        N::getTids(N::getValue(leaf), res);
+        return true;
+    }
+
+    template<uint16_t KeyLen>
+    void ART<KeyLen>::lookupBatch(const Key *keys, size_t n, TID *out, bool *found) const {
+        ThreadInfo ti(epoch_);
+        EpochGuard guard(ti);
+
+        struct State {
+            size_t idx;
+            const N *cur;
+            const N *parent;
+            uint64_t pv;
+            uint16_t level;
+            uint8_t type;   /* of cur, taken from the tag of the slot it was found in */
+            uint16_t depth;
+            uint64_t start; /* version of the replica it started in, see startNode */
         };
+        State states[LOOKUP_BATCH_INFLIGHT];
+        size_t issued = 0, active = 0, i = 0;
+        bool rowex = sync_ == SyncMode::ROWEX; /* no versions to take or check */
 
-        std::function<void(const N*, uint16_t&)> find_start = [&](const N* cur, uint16_t& level) {
-            int res = checkPrefix(cur, k1, level);
-            if (res > 0) {
-                return ;
-            } else if (res < 0) {
-                copy(cur);
-            } else {
-                std::tuple<uint8_t, N*> children[256];
-                uint16_t len;
-
-                N::getChildren(cur, k1[level], 255, children, len);
-                for (int i = 0; i < len; i++) {
-                    const N* child = std::get<1>(children[i]);
-                    if (i == 0) {
-                        find_start(child, level);
+        auto begin = [this, rowex](State &s, size_t idx) {
+            s = {idx, nullptr, nullptr, 0, 0, 0, 0, STALE};
+            s.cur = rowex ? root_ : startNode(s.start);
+            s.type = s.cur->getType();
+        };
+        while (active < LOOKUP_BATCH_INFLIGHT && issued < n) {
+            begin(states[active++], issued++);
+        }
+
+        while (active > 0) {
+            State &s = states[i];
+            const Key &key = keys[s.idx];
+            bool needRestart = false, done = false;
+            uint64_t v = 0;
+            Slot slot;
+            N *next;
+
+            /* s.cur was prefetched when this state was last advanced */
+            if (!rowex) {
+                v = s.cur->readLockOrRestart(needRestart);
+                if (!needRestart && s.depth == replicatedLevels_ && s.start != STALE &&
+                    upperVersion_.load(std::memory_order_acquire) != s.start) {
+                    needRestart = true;
+                }
+                if (!needRestart && s.parent != nullptr) {
+                    s.parent->readUnlockOrRestart(s.pv, needRestart);
+                }
+            }
+            if (!needRestart) {
+                if (!checkPrefix(s.cur, key, s.level)) {
+                    if (!rowex) s.cur->readUnlockOrRestart(v, needRestart);
+                    found[s.idx] = false;
+                    done = true;
+                } else {
+                    slot = N::findSlot(s.cur, s.type, key[s.level]);
+                    next = N::untagChild(slot);
+                    if (!rowex) s.cur->readUnlockOrRestart(v, needRestart);
+                    if (needRestart) {
+                        /* handled below */
+                    } else if (next == nullptr) {
+                        found[s.idx] = false;
+                        done = true;
+                    } else if (N::isLeaf(next)) {
+                        found[s.idx] = N::isKeyLeaf(next) ? N::getKeyLeaf(next)->match(key)
+                                                          : s.level == key.getKeyLen() - 1;
+                        out[s.idx] = N::getLeaf(next);
+                        done = true;
                     } else {
-                        copy(child);
+                        __builtin_prefetch(next);
+                        s.parent = s.cur;
+                        s.pv = v;
+                        s.cur = next;
+                        s.type = N::childType(slot);
+                        s.level++;
+                        s.depth++;
                     }
                 }
             }
-        };
+            if (needRestart) { /* a writer got in the way, finish this key on the ordinary path */
+                found[s.idx] = lookup(key, out[s.idx]);
+                done = true;
+            }
 
-        std::function<void(const N*, uint16_t&)> find_end = [&](const N* cur, uint16_t& level) {
-            int res = checkPrefix(cur, k1, level);
-            if (res < 0) {
-                return ;
-            } else if (res > 0) {
-                copy(cur);
-            } else {
-                std::tuple<uint8_t, N*> children[256];
-                uint16_t len;
-
-                N::getChildren(cur, 0, k1[level], children, len);
-                for (int i = 0; i < len; i++) {
-                    const N* child = std::get<1>(children[i]);
-                    if (i == len - 1) {
-                        find_end(child, level);
-                    } else {
-                        copy(child);
-                    }
+            if (done) {
+                if (issued < n) {
+                    begin(s, issued++);
+                } else {
+                    s = states[--active];
+                    if (i >= active) i = 0;
+                    continue;
                 }
             }
-        };
+            if (++i == active) i = 0;
+        }
+    }
 
+    template<uint16_t KeyLen>
+    bool ART<KeyLen>::lookupRange(const Key &k1, const Key &k2, vector<TID> &res) const {
+        Iterator it(this);
+        size_t before = res.size();
+        for (it.seek(k1); it.valid() && !(k2 < it.key()); it.next()) {
+            it.tids(res);
+        }
+        return res.size() > before;
+    }
+
+    template<uint16_t KeyLen>
+    ART<KeyLen>::Iterator::Iterator(const ART *tree) : tree_(tree), ti_(tree->epoch_), guard_(ti_) {}
+
+    template<uint16_t KeyLen>
+    void ART<KeyLen>::Iterator::seek(const Key &key) {
         int restartCount = 0;
-        restart:
-        if (restartCount++) {
-            yield(restartCount);
+        while (!seekImpl(key, true)) {
+            tree_->yield(++restartCount);
+        }
+    }
+
+    template<uint16_t KeyLen>
+    void ART<KeyLen>::Iterator::seekForPrev(const Key &key) {
+        int restartCount = 0;
+        while (!seekImpl(key, false)) {
+            tree_->yield(++restartCount);
+        }
+    }
+
+    template<uint16_t KeyLen>
+    void ART<KeyLen>::Iterator::next() {
+        if (valid_) resume(true);
+    }
+
+    template<uint16_t KeyLen>
+    void ART<KeyLen>::Iterator::prev() {
+        if (valid_) resume(false);
+    }
+
+    template<uint16_t KeyLen>
+    void ART<KeyLen>::Iterator::resume(bool forward) {
+        Key last = key_;
+        int restartCount = 0;
+        while (!step(forward)) {
+            /* Rebuild the path to the last returned key; stop if it is gone and we already moved past */
+            do {
+                tree_->yield(++restartCount);
+            } while (!seekImpl(last, forward));
+            if (!valid_ || key_ != last) {
+                return;
+            }
+        }
+    }
+
+    template<uint16_t KeyLen>
+    void ART<KeyLen>::Iterator::setLeaf(const N *leaf, uint16_t level) {
+        if (N::isKeyLeaf(leaf)) {
+            const KeyLeaf *l = N::getKeyLeaf(leaf);
+            memcpy(&key_[0], l->key, l->len);
+            setKeyLen(key_, l->len);
+        } else {
+            setKeyLen(key_, level + 1);
+        }
+        value_ = N::getValue(leaf);
+        valid_ = true;
+    }
+
+    template<uint16_t KeyLen>
+    bool ART<KeyLen>::Iterator::readVersion(const N *n, uint64_t &v) const {
+        if (tree_->sync_ == SyncMode::ROWEX) {
+            v = 0;
+            return true;
+        }
+        bool needRestart = false;
+        v = n->readLockOrRestart(needRestart);
+        return !needRestart;
+    }
+
+    template<uint16_t KeyLen>
+    bool ART<KeyLen>::Iterator::changed(const N *n, uint64_t v) const {
+        if (tree_->sync_ == SyncMode::ROWEX) {
+            return false;
         }
         bool needRestart = false;
+        n->readUnlockOrRestart(v, needRestart);
+        return needRestart;
+    }
 
+    template<uint16_t KeyLen>
+    bool ART<KeyLen>::Iterator::seekImpl(const Key &key, bool forward) {
+        depth_ = 0;
+        valid_ = false;
+
+        const N *cur = tree_->root_;
+        N *next;
         uint16_t level = 0;
-        N* cur = root_;
-        N* parent;
-        uint64_t v = 0;
-        uint16_t start_key, end_key;
+        uint64_t v, nv;
+        uint8_t k;
 
+        if (!readVersion(cur, v)) return false;
         while (true) {
-            READ_LOCK(cur, v, needRestart)
-            if (checkPrefix(cur, k1, k2, level, start_key, end_key)) {
-                std::tuple<uint8_t, N*> children[256];
-                uint16_t len;
-
-                N::getChildren(cur, start_key, end_key, children, len);
-
-                if (len >= 2) {
-                    for (int i = 0; i < len; ++i) {
-                        const N *n = std::get<1>(children[i]);
-                        if (i == 0) {
-                            uint16_t level_copy = level;
-                            find_start(n, level_copy);
-                        } else if (i == len - 1) {
-                            uint16_t level_copy = level;
-                            find_end(n, level_copy);
-                        } else {
-                            copy(n);
-                        }
-                    }
-                } else if (len == 1) {
-                    READ_UNLOCK(cur, v, needRestart)
-                    parent = cur;
-                    cur = N::getChild(parent, start_key);
-                } else {
-                    return false;
+            uint16_t start = level;
+            for (int i = 0; i < cur->getPrefixLen(); i++) {
+                uint8_t p = cur->getPrefix()[i];
+                if (p != key[level]) {
+                    bool greater = p > key[level];
+                    if (changed(cur, v)) return false;
+                    /* the whole subtree is on one side of key */
+                    return greater == forward ? descend(cur, v, start, forward) : step(forward);
                 }
-            } else {
-                return false;
+                key_[level++] = p;
+            }
+
+            k = key[level];
+            next = N::findChild(cur, k);
+            if (next == nullptr) {
+                next = forward ? N::getNextChild(cur, k + 1, k) : N::getPrevChild(cur, k - 1, k);
+            }
+            if (changed(cur, v)) return false;
+            if (next == nullptr) {
+                return step(forward);
+            }
+
+            key_[level] = k;
+            stack_[depth_++] = {cur, v, level, k};
+            if (N::isLeaf(next)) {
+                setLeaf(next, level);
+                /* a KeyLeaf on the search path may still hold a key on the wrong side of key */
+                if (k == key[level] && N::isKeyLeaf(next) && (forward ? key_ < key : key < key_)) {
+                    return step(forward);
+                }
+                return true;
+            }
+
+            if (!readVersion(next, nv)) return false;
+            if (changed(cur, v)) return false;
+
+            if (k != key[level]) { /* took a neighbour branch, its extreme leaf is the answer */
+                return descend(next, nv, level + 1, forward);
             }
+            cur = next;
+            v = nv;
             level++;
         }
     }
 
     template<uint16_t KeyLen>
-    void ART<KeyLen>::insert(const Key &key, TID tid) {
+    bool ART<KeyLen>::Iterator::descend(const N *cur, uint64_t v, uint16_t level, bool forward) {
+        N *next;
+        uint64_t nv;
+        uint8_t k;
+
+        while (true) {
+            for (int i = 0; i < cur->getPrefixLen(); i++) {
+                key_[level++] = cur->getPrefix()[i];
+            }
+            next = forward ? N::getNextChild(cur, 0, k) : N::getPrevChild(cur, 255, k);
+            if (changed(cur, v)) return false;
+            if (next == nullptr) {
+                return step(forward);
+            }
+
+            key_[level] = k;
+            stack_[depth_++] = {cur, v, level, k};
+            if (N::isLeaf(next)) {
+                setLeaf(next, level);
+                return true;
+            }
+
+            if (!readVersion(next, nv)) return false;
+            if (changed(cur, v)) return false;
+            cur = next;
+            v = nv;
+            level++;
+        }
+    }
+
+    template<uint16_t KeyLen>
+    bool ART<KeyLen>::Iterator::step(bool forward) {
+        N *next;
+        uint64_t nv;
+        uint8_t k;
+
+        valid_ = false;
+        while (depth_ > 0) {
+            Frame &f = stack_[depth_ - 1];
+            next = forward ? N::getNextChild(f.node, f.k + 1, k) : N::getPrevChild(f.node, f.k - 1, k);
+            if (changed(f.node, f.v)) return false;
+            if (next == nullptr) {
+                depth_--;
+                continue;
+            }
+
+            f.k = k;
+            key_[f.level] = k;
+            if (N::isLeaf(next)) {
+                setLeaf(next, f.level);
+                return true;
+            }
+
+            if (!readVersion(next, nv)) return false;
+            if (changed(f.node, f.v)) return false;
+            return descend(next, nv, f.level + 1, forward);
+        }
+        return true;
+    }
+
+    template<uint16_t KeyLen>
+    bool ART<KeyLen>::insert(const Key &key, TID tid) {
+        return insertImpl(key, [tid](const uint64_t *old, uint64_t &value) {
+            value = tid;
+            return true;
+        });
+    }
+
+    template<uint16_t KeyLen>
+    bool ART<KeyLen>::insertDuplicate(const Key &key, TID tid) {
+        return insertImpl(key, [tid](const uint64_t *old, uint64_t &value) {
+            value = old ? N::addTid(*old, tid) : tid;
+            return true;
+        });
+    }
+
+    template<uint16_t KeyLen>
+    std::optional<TID> ART<KeyLen>::insertIfAbsent(const Key &key, TID tid) {
+        std::optional<TID> res;
+        insertImpl(key, [tid, &res](const uint64_t *old, uint64_t &value) {
+            if (old) {
+                res = N::firstTid(*old);
+                return false;
+            }
+            value = tid;
+            return true;
+        });
+        return res;
+    }
+
+    template<uint16_t KeyLen>
+    bool ART<KeyLen>::compareAndSwap(const Key &key, TID expected, TID desired) {
+        return insertImpl(key, [expected, desired](const uint64_t *old, uint64_t &value) {
+            if (!old || *old != expected) {
+                return false;
+            }
+            value = desired;
+            return true;
+        });
+    }
+
+    template<uint16_t KeyLen>
+    std::optional<TID> ART<KeyLen>::upsert(const Key &key, const std::function<TID(std::optional<TID>)> &fn) {
+        std::optional<TID> res;
+        insertImpl(key, [&fn, &res](const uint64_t *old, uint64_t &value) {
+            if (old) {
+                res = N::firstTid(*old);
+            }
+            value = fn(res);
+            return true;
+        });
+        return res;
+    }
+
+    template<uint16_t KeyLen>
+    template<typename Update>
+    bool ART<KeyLen>::insertImpl(const Key &key, const Update &update) {
+        ThreadInfo ti(epoch_);
+        EpochGuard guard(ti);
+
         int restartCount = 0;
         restart:
         if (restartCount++) {
@@ -280,9 +731,9 @@ namespace Index {
         N *next = root_;
         N *parent;
         uint8_t pk = 0, k = 0;
-        uint16_t level = 0;
-        uint64_t v, pv;
-        uint8_t remainPrefix[MAX_PREFIX_LEN];
+        uint16_t level = 0, depth = 0;
+        uint64_t v, pv, value;
+        uint8_t remainPrefix[Key::MAX_LEN];
         uint8_t no_match_key = 0, remain_prefix_len = 0;
 
         while (level < key.getKeyLen()) {
@@ -294,43 +745,121 @@ namespace Index {
 
             uint16_t nextLevel = level;
             if (!checkPrefix(cur, key, nextLevel, no_match_key, remainPrefix, remain_prefix_len)) { /* No Match */
+                if (art_obj_pool_->overBudget()) { /* only writes that need memory are refused */
+                    return false;
+                }
                 COUPLING_LOCK(cur, parent, pv, v, needRestart)
+                if (!update(nullptr, value)) {
+                    UNCHANGED_UNLOCK(cur)
+                    UNCHANGED_UNLOCK(parent)
+                    return false;
+                }
+                UpperWrite upper(this, depth - 1);
                 N *newNode = art_obj_pool_->newNode(NT4);
-                N *nextNode = GenNewNode(key, nextLevel + 1, tid);
+                N *nextNode = GenNewNode(key, nextLevel + 1, value);
                 newNode->setPrefix(cur->getPrefix(), nextLevel - level);
-                cur->setPrefix(remainPrefix, remain_prefix_len);
 
-                N::setChild(newNode, no_match_key, cur);
+                /* a long prefix, or any under ROWEX, cannot change under readers, its remainder goes into a copy of cur */
+                N *rest = cur;
+                if (cur->getPrefixLen() > MAX_PREFIX_LEN || sync_ == SyncMode::ROWEX) {
+                    rest = N::copyWithPrefix(cur, remainPrefix, remain_prefix_len, art_obj_pool_);
+                } else {
+                    cur->setPrefix(remainPrefix, remain_prefix_len);
+                }
+
+                N::setChild(newNode, no_match_key, rest);
                 N::setChild(newNode, key[nextLevel], nextNode);
                 N::changeChild(parent, pk, newNode);
 
-                WRITE_UNLOCK(cur)
+                if (rest != cur) {
+                    DELETE_UNLOCK(cur)
+                    retireNode(cur, ti);
+                } else {
+                    WRITE_UNLOCK(cur)
+                }
                 WRITE_UNLOCK(parent)
-                return;
+                return true;
             }
             READ_UNLOCK(cur, v, needRestart)
             k = key[nextLevel];
-            if (!N::getChild(cur, k)) { /* Specific Slot is NULL */
+            next = N::findChild(cur, k);
+            /* next may come from a half done change of cur, it is followed only once cur is known unchanged */
+            READ_UNLOCK(cur, v, needRestart)
+            if (next == nullptr) { /* Specific Slot is NULL */
+                if (art_obj_pool_->overBudget()) {
+                    return false;
+                }
                 if (cur->isFull()) {
                     COUPLING_LOCK(cur, parent, pv, v, needRestart)
-                    N::insertAndGrow(cur, parent, pk, k, GenNewNode(key, nextLevel + 1, tid), art_obj_pool_);
+                    if (!update(nullptr, value)) {
+                        UNCHANGED_UNLOCK(cur)
+                        UNCHANGED_UNLOCK(parent)
+                        return false;
+                    }
+                    UpperWrite upper(this, depth - 1);
+                    N::insertAndGrow(cur, parent, pk, k, GenNewNode(key, nextLevel + 1, value), art_obj_pool_);
+                    DELETE_UNLOCK(cur)
+                    WRITE_UNLOCK(parent)
+                    retireNode(cur, ti);
+                } else if (sync_ == SyncMode::ROWEX && cur->getType() != NT256) {
+                    /* ROWEX readers may be inside cur, only a N256 takes a new child in place */
+                    COUPLING_LOCK(cur, parent, pv, v, needRestart)
+                    if (!update(nullptr, value)) {
+                        UNCHANGED_UNLOCK(cur)
+                        UNCHANGED_UNLOCK(parent)
+                        return false;
+                    }
+                    UpperWrite upper(this, depth - 1);
+                    N *copy = N::copyWithPrefix(cur, cur->getPrefix(), cur->getPrefixLen(), art_obj_pool_);
+                    N::setChild(copy, k, GenNewNode(key, nextLevel + 1, value));
+                    N::changeChild(parent, pk, copy);
                     DELETE_UNLOCK(cur)
                     WRITE_UNLOCK(parent)
-                    art_obj_pool_->gcNode(cur);
+                    retireNode(cur, ti);
                 } else {
                     UPGRADE_LOCK(cur, v, needRestart)
-                    N::setChild(cur, k, GenNewNode(key, nextLevel + 1, tid));
+                    if (!update(nullptr, value)) {
+                        UNCHANGED_UNLOCK(cur)
+                        return false;
+                    }
+                    UpperWrite upper(this, depth);
+                    N::setChild(cur, k, GenNewNode(key, nextLevel + 1, value));
                     WRITE_UNLOCK(cur)
                 }
-                return;
+                return true;
             } else {
-                next = N::getChild(cur, k);
-
-                if (N::isLeaf(next)) { /* The Same Key is thought as Update */
+                if (N::isLeaf(next)) {
+                    bool same = !N::isKeyLeaf(next) || N::getKeyLeaf(next)->match(key);
+                    if (!same && art_obj_pool_->overBudget()) {
+                        return false;
+                    }
                     UPGRADE_LOCK(cur, v, needRestart)
-                    N::changeChild(cur, k, (N *) N::convertToLeaf(tid));
+                    uint64_t old = N::getValue(next);
+                    if (!update(same ? &old : nullptr, value)) {
+                        UNCHANGED_UNLOCK(cur)
+                        return false;
+                    }
+                    UpperWrite upper(this, depth);
+                    if (!same) { /* a second key under this slot, only now the path down to where they differ is built */
+                        N::changeChild(cur, k, expandLeaf(next, key, nextLevel + 1, value));
+                        WRITE_UNLOCK(cur)
+                        return true;
+                    }
+
+                    /* The Same Key is thought as Update */
+                    if (N::isKeyLeaf(next)) {
+                        N::getKeyLeaf(next)->value = value;
+                    } else {
+                        N::changeChild(cur, k, (N *) N::convertToLeaf(value));
+                    }
                     WRITE_UNLOCK(cur)
-                    return;
+                    if (value != old && N::isTidList(value)) {
+                        art_obj_pool_->leafAllocated(N::leafBytes((N *) N::convertToLeaf(value)));
+                    }
+                    if (value != old && N::isTidList(old)) {
+                        retireNode((N *) N::convertToLeaf(old), ti);
+                    }
+                    return true;
                 }
 
                 if (parent != nullptr) {
@@ -338,11 +867,217 @@ namespace Index {
                 }
             }
             level = nextLevel + 1;
+            depth++;
         }
+        return false;
+    }
+
+    template<uint16_t KeyLen>
+    N *ART<KeyLen>::expandLeaf(N *leaf, const Key &key, uint16_t level, TID tid) {
+        const KeyLeaf *old = N::getKeyLeaf(leaf);
+
+        /* both keys are distinct and prefix-free, they differ before either ends */
+        uint16_t d = level;
+        while (old->key[d] == key[d]) {
+            d++;
+        }
+
+        N *n = art_obj_pool_->newNode(NT4);
+        n->setPrefix(old->key + level, d - level);
+        N::setChild(n, old->key[d], leaf);
+        N::setChild(n, key[d], GenNewNode(key, d + 1, tid));
+        return n;
+    }
+
+    template<uint16_t KeyLen>
+    bool ART<KeyLen>::remove(const Key &key) {
+        return removeImpl(key, nullptr);
     }
 
+    template<uint16_t KeyLen>
+    bool ART<KeyLen>::removeTid(const Key &key, TID tid) {
+        return removeImpl(key, &tid);
+    }
+
+    template<uint16_t KeyLen>
+    bool ART<KeyLen>::removeImpl(const Key &key, const TID *tid) {
+        ThreadInfo ti(epoch_);
+        EpochGuard guard(ti);
+
+        int restartCount = 0;
+        restart:
+        if (restartCount++) {
+            yield(restartCount);
+        }
+        bool needRestart = false;
+
+        N *path[Key::MAX_LEN];
+        uint64_t versions[Key::MAX_LEN];
+        uint8_t keys[Key::MAX_LEN];
+        uint16_t depth = 0;
+
+        N *cur = root_;
+        N *next;
+        uint16_t level = 0;
+        uint64_t v, nv;
+
+        READ_LOCK(cur, v, needRestart)
+        while (true) {
+            if (!checkPrefix(cur, key, level)) { /* No Match */
+                READ_UNLOCK(cur, v, needRestart)
+                return false;
+            }
+            next = N::findChild(cur, key[level]);
+            READ_UNLOCK(cur, v, needRestart)
+
+            path[depth] = cur;
+            versions[depth] = v;
+            keys[depth] = key[level];
+            depth++;
+
+            if (next == nullptr) {
+                return false;
+            }
+            if (N::isLeaf(next)) {
+                if (N::isKeyLeaf(next) ? !N::getKeyLeaf(next)->match(key) : level != key.getKeyLen() - 1) {
+                    return false;
+                }
+                break;
+            }
+            level++;
+
+            READ_LOCK(next, nv, needRestart)
+            READ_UNLOCK(cur, v, needRestart)
+            cur = next;
+            v = nv;
+        }
+
+        if (tid != nullptr) { /* only tid goes, the key itself only with its last TID */
+            uint64_t value = N::getValue(next);
+            READ_UNLOCK(cur, v, needRestart)
+            if (!N::hasTid(value, *tid)) {
+                return false;
+            }
+            if (N::hasSeveralTids(value)) {
+                UPGRADE_LOCK(cur, v, needRestart)
+                UpperWrite upper(this, depth - 1);
+                uint64_t rest = N::removeTid(value, *tid);
+                if (N::isKeyLeaf(next)) {
+                    N::getKeyLeaf(next)->value = rest;
+                } else {
+                    N::changeChild(cur, keys[depth - 1], (N *) N::convertToLeaf(rest));
+                }
+                WRITE_UNLOCK(cur)
+                if (N::isTidList(rest)) {
+                    art_obj_pool_->leafAllocated(N::leafBytes((N *) N::convertToLeaf(rest)));
+                }
+                if (N::isTidList(value)) {
+                    retireNode((N *) N::convertToLeaf(value), ti);
+                }
+                return true;
+            }
+        }
+
+        /* Nodes with a single child only lead to this key, so they go away with it */
+        uint16_t top = depth - 1;
+        while (top > 0 && path[top]->getCount() == 1) {
+            top--;
+        }
+
+        N *node = path[top];
+        N *parent = top > 0 ? path[top - 1] : nullptr;
+        uint8_t pk = top > 0 ? keys[top - 1] : 0;
+        bool shrink = parent != nullptr && node->isUnderFull();
+        bool collapse = parent != nullptr && node->getType() == NT4 && node->getCount() == 2;
+        /* under ROWEX only a N256 loses a child in place, any other node is replaced by a copy without it */
+        bool copy = parent != nullptr && sync_ == SyncMode::ROWEX && node->getType() != NT256;
+
+        /* Lock top down: parent (only if node gets replaced), node, then the chain below */
+        uint16_t first = (shrink || collapse || copy) ? top - 1 : top;
+        for (uint16_t i = first; i < depth; i++) {
+            path[i]->upgradeToWriteLockOrRestart(versions[i], needRestart);
+            if (needRestart) {
+                for (uint16_t j = first; j < i; j++) {
+                    WRITE_UNLOCK(path[j])
+                }
+                goto restart;
+            }
+        }
+        UpperWrite upper(this, first);
+
+        if (shrink) {
+            N::removeAndShrink(node, parent, pk, keys[top], art_obj_pool_);
+            DELETE_UNLOCK(node)
+            WRITE_UNLOCK(parent)
+            retireNode(node, ti);
+        } else {
+            bool merged = false;
+            if (collapse) {
+                /* Merge a single-child N4 into its child's prefix, node is left as it is for readers */
+                uint8_t ck;
+                N *child = N::getNextChild(node, 0, ck);
+                if (ck == keys[top]) {
+                    child = N::getNextChild(node, ck + 1, ck);
+                }
+                if (N::isKeyLeaf(child)) { /* a KeyLeaf carries its key and may hang anywhere above */
+                    N::changeChild(parent, pk, child);
+                    merged = true;
+                } else if (!N::isLeaf(child)) {
+                    bool lockFailed = false;
+                    child->writeLockOrRestart(lockFailed);
+                    if (!lockFailed) {
+                        uint8_t prefix[Key::MAX_LEN];
+                        uint16_t len = node->getPrefixLen();
+                        memcpy(prefix, node->getPrefix(), len);
+                        prefix[len++] = ck;
+                        memcpy(prefix + len, child->getPrefix(), child->getPrefixLen());
+                        len += child->getPrefixLen();
+
+                        /* the child can not switch to a long prefix in place, nor to any under ROWEX */
+                        if (len > MAX_PREFIX_LEN || sync_ == SyncMode::ROWEX) {
+                            N *merge = N::copyWithPrefix(child, prefix, len, art_obj_pool_);
+                            N::changeChild(parent, pk, merge);
+                            DELETE_UNLOCK(child)
+                            retireNode(child, ti);
+                        } else {
+                            child->setPrefix(prefix, len);
+                            N::changeChild(parent, pk, child);
+                            WRITE_UNLOCK(child)
+                        }
+                        merged = true;
+                    }
+                }
+            }
+            if (merged) {
+                DELETE_UNLOCK(node)
+                retireNode(node, ti);
+            } else if (copy) {
+                N *rest = N::copyWithPrefix(node, node->getPrefix(), node->getPrefixLen(), art_obj_pool_);
+                N::removeChild(rest, keys[top]);
+                N::changeChild(parent, pk, rest);
+                DELETE_UNLOCK(node)
+                retireNode(node, ti);
+            } else {
+                N::removeChild(node, keys[top]);
+                WRITE_UNLOCK(node)
+            }
+            if (first < top) {
+                WRITE_UNLOCK(parent)
+            }
+        }
+
+        for (uint16_t i = top + 1; i < depth; i++) {
+            DELETE_UNLOCK(path[i])
+            retireNode(path[i], ti);
+        }
+        if (N::isKeyLeaf(next) || N::isTidList(N::getValue(next))) {
+            retireNode(next, ti);
+        }
+        return true;
+    }
 }
 
+template class Index::ART<Index::VAR_KEY_LEN>;
 template class Index::ART<32>;
 template class Index::ART<64>;
 template class Index::ART<128>;
@@ -3,6 +3,8 @@
 #include <vector>
 #include <iostream>
 #include <algorithm>
+#include <functional>
+#include <optional>
 
 #include "sched.h"
 #include "emmintrin.h"
@@ -11,12 +13,24 @@
 #include "common/common.h"
 #include "art_node.h"
 #include "art_obj_pool.h"
+#include "epoch.h"
 #include "catalog.h"
 
 namespace Index {
 
+    template<uint16_t KeyLen>
+    class IndexBuilder;
+
+    /* how readers get past concurrent writers, see ART::setSyncMode */
+    enum class SyncMode : uint8_t {
+        OLC,
+        ROWEX,
+    };
+
     template<uint16_t KeyLen>
     class ART {
+        friend class IndexBuilder<KeyLen>;
+
         using Key = KEY<KeyLen>;
 
         enum class Result : uint8_t {
@@ -29,13 +43,165 @@ namespace Index {
             return a > b ? b : a;
         }
 
+        /* the iterator rebuilds keys byte by byte, only variable-length keys carry their length */
+        static void setKeyLen(Key &key, uint16_t len) {
+            if constexpr (KeyLen == VAR_KEY_LEN) {
+                key.setKeyLen(len);
+            }
+        }
+
         N *root_ = nullptr;
 
         Index::ArtObjPool *art_obj_pool_ = nullptr;
 
+        /* Obsolete nodes go back to art_obj_pool_ only after every reader has left their epoch */
+        mutable Index::Epoch epoch_;
+
+        SyncMode sync_ = SyncMode::OLC;
+
+        /**
+         * Upper-level replication, see replicateUpperLevels. The low bits of upperVersion_ count
+         * the writers changing a node above replicatedLevels_, the high bits how many such writes
+         * have begun. A replica is a copy of those nodes made while no such writer was active,
+         * and serves lookups only while upperVersion_ still equals the version it was made at.
+         */
+        static const uint64_t UPPER_WRITE = 1ULL << 16;
+
+        static const uint64_t STALE = 1;   // never the version of a quiet tree
+
+        struct alignas(CACHE_LINE_SIZE) Replica {
+            std::atomic<uint64_t> version{STALE};
+            std::atomic<N *> root{nullptr};
+            std::atomic<bool> building{false};
+        };
+
+        uint16_t replicatedLevels_ = 0;
+
+        alignas(CACHE_LINE_SIZE) std::atomic<uint64_t> upperVersion_{0};
+
+        mutable Replica replicas_[ArtObjPool::MAX_NUMA_NODES];
+
+        mutable std::atomic<uint64_t> replicaBuilds_{0};
+
+        /* counts a writer in upperVersion_ while it changes the node at depth, if that is a replicated one */
+        class UpperWrite {
+            ART *tree_;
+            bool upper_;
+        public:
+            UpperWrite(ART *tree, uint16_t depth) : tree_(tree), upper_(depth < tree->replicatedLevels_) {
+                if (upper_) tree_->upperVersion_.fetch_add(UPPER_WRITE + 1);
+            }
+
+            ~UpperWrite() {
+                if (upper_) tree_->upperVersion_.fetch_sub(1);
+            }
+        };
+
+        /**
+         * Where a descent starts: the replica of the caller's NUMA node if it is current, making
+         * it first if it is not and no upper writer is active, otherwise root_. version is then
+         * the replica's version, or STALE for root_. A descent through a replica has to find
+         * upperVersion_ still at version after locking its first node below the replica.
+         */
+        N *startNode(uint64_t &version) const;
+
+        /* copies n and, above replicatedLevels_, the nodes below it; false if a writer got in the way */
+        bool copyUpper(const N *n, uint16_t depth, N *&copy) const;
+
+        /* gives the copies of a replica back, through the epoch if readers may still be in it */
+        void dropReplica(N *copy, uint16_t depth, ThreadInfo *ti) const;
+
+        /* gives the subtree of n back to art_obj_pool_, once no thread uses the tree any more */
         void GC(N* n);
 
+        /* n is a node or a leaf, see N::releaseLeaf */
+        void retireNode(N *n, ThreadInfo &ti);
+
+        /* the leaf of key or nullptr, the caller keeps the epoch */
+        N *findLeaf(const Key &key) const;
+
+        /* findLeaf for ROWEX trees, without versions */
+        N *findLeafWaitFree(const Key &key) const;
+
+        /**
+         * The one insert descent behind every write API. Once the nodes to change are locked,
+         * update(old, value) is called exactly once, with old == nullptr if key is absent; it
+         * returns false to leave the tree as it is, or sets the value to store.
+         */
+        template<typename Update>
+        bool insertImpl(const Key &key, const Update &update);
+
+        /* removes only *tid if given */
+        bool removeImpl(const Key &key, const TID *tid);
+
     public:
+        /**
+         * Ordered cursor over the leaves. The path from the root is kept on a fixed stack
+         * and every step re-validates the versions of the nodes it reads; when one of them
+         * changed, the cursor seeks again from the last key it returned instead of
+         * restarting the whole scan (ROWEX trees need neither, see setSyncMode). It stays
+         * inside the epoch while alive, keep it short-lived.
+         */
+        class Iterator {
+            struct Frame {
+                const N *node;
+                uint64_t v;
+                uint16_t level; // key byte this node branches on
+                uint8_t k;      // branch currently taken
+            };
+
+            const ART *tree_;
+            ThreadInfo ti_;
+            EpochGuard guard_;
+
+            Frame stack_[Key::MAX_LEN];
+            uint16_t depth_ = 0;
+            Key key_;
+            uint64_t value_ = 0;
+            bool valid_ = false;
+
+            /* all return false if a node changed under them and the position must be rebuilt */
+            bool seekImpl(const Key &key, bool forward);
+
+            bool descend(const N *n, uint64_t v, uint16_t level, bool forward);
+
+            bool step(bool forward);
+
+            void resume(bool forward);
+
+            /* leaf hangs below the branch at level; KeyLeafs overwrite key_ with their whole key */
+            void setLeaf(const N *leaf, uint16_t level);
+
+            /* the version checks, which always pass on a ROWEX tree */
+            bool readVersion(const N *n, uint64_t &v) const;
+
+            bool changed(const N *n, uint64_t v) const;
+
+        public:
+            explicit Iterator(const ART *tree);
+
+            DISALLOW_COPY_AND_MOVE(Iterator)
+
+            /* first key >= key */
+            void seek(const Key &key);
+
+            /* last key <= key */
+            void seekForPrev(const Key &key);
+
+            bool valid() const { return valid_; }
+
+            void next();
+
+            void prev();
+
+            const Key &key() const { return key_; }
+
+            TID tid() const { return N::firstTid(value_); }
+
+            /* appends all TIDs of the current key */
+            void tids(vector<TID> &res) const { N::getTids(value_, res); }
+        };
+
         ART(Index::ArtObjPool *art_obj_pool);
 
         ~ART();
@@ -55,7 +221,7 @@ namespace Index {
         bool checkPrefix(const N* n, const Key &start, const Key &end, uint16_t &level,
                          uint16_t& k1, uint16_t& k2) const {
             uint8_t start_key, end_key;
-            k1 = k2 = -1;
+            k1 = k2 = UINT16_MAX;
             for (int i = 0; i < n->getPrefixLen(); i++) {
                 start_key = start[level];
                 end_key = end[level];
@@ -69,8 +235,8 @@ namespace Index {
                 }
                 level++;
             }
-            if (k1 == -1) k1 = start[level];
-            if (k2 == -1) k2 = end[level];
+            if (k1 == UINT16_MAX) k1 = start[level];
+            if (k2 == UINT16_MAX) k2 = end[level];
             return true;
         }
 
@@ -90,30 +256,108 @@ namespace Index {
             return true;
         }
 
+        /* Subtree holding only key below level: the inline TID at the last byte, otherwise one KeyLeaf */
         N *GenNewNode(const Key &key, uint16_t level, TID tid) {
-            N *n;
-            uint8_t p_len;
-
             if (level < key.getKeyLen()) {
-                n = new N4();
-                p_len = min(MAX_PREFIX_LEN, key.getKeyLen() - level - 1);
-                n->setPrefix((uint8_t *) &key[level], p_len);
-                level += p_len;
-
-                N::setChild(n, key[level], GenNewNode(key, level + 1, tid));
-            } else {
-                return (N *) N::convertToLeaf(tid);
+                art_obj_pool_->leafAllocated(sizeof(KeyLeaf) + key.getKeyLen());
+                return N::convertToLeaf(KeyLeaf::make(key, tid));
             }
-            return n;
+            return (N *) N::convertToLeaf(tid);
         }
 
+        /* Splits a KeyLeaf hanging at level once key, a different key, arrives below the same slot */
+        N *expandLeaf(N *leaf, const Key &key, uint16_t level, TID tid);
+
+        /* for a key with several TIDs, the smallest one */
         bool lookup(const Key &key, TID &tid) const;
 
-        bool lookupRange(const Key &k1, const Key &k2, vector<TID> &res);
+        /* appends every TID of key */
+        bool lookupAll(const Key &key, vector<TID> &res) const;
+
+        /**
+         * Keeps a copy of the nodes of the top levels of the tree for each NUMA node, made from that
+         * node's pool memory on first use there, and lets lookup and lookupBatch start from the
+         * caller's copy, so only the deeper, per-key part of a descent may cross sockets. Any
+         * write to one of these levels makes every copy stale until a reader makes a new one, so
+         * this pays only for trees whose top levels rarely change. Range scans and iterators
+         * always use the tree itself. Call before the tree is shared; 0 turns it off.
+         */
+        void replicateUpperLevels(uint16_t levels);
+
+        /* replicas made so far, on all NUMA nodes */
+        uint64_t replicaBuilds() const { return replicaBuilds_.load(); }
+
+        /**
+         * OLC readers validate node versions and restart when a writer got in between. Under ROWEX
+         * a node that readers can reach changes only by single slot stores, replacing a child or
+         * a leaf value, and N256 gains and loses children that way too; any other change to a
+         * node, its prefix included, is made on a copy published through the parent. Lookups,
+         * batches and iterators then read without versions and never restart, for more copying
+         * on writes; writers lock as before. ROWEX readers do not use upper-level replicas.
+         * With ART_ARENA_REFS an overwritten slot gives its arena cell back at once, so the tree
+         * stays OLC there. Call before the tree is shared.
+         */
+        void setSyncMode(SyncMode mode);
+
+        SyncMode syncMode() const { return sync_; }
+
+        /* frees retired nodes on a background thread instead of the writers, see Epoch::startReclaimer */
+        void reclaimInBackground() { epoch_.startReclaimer(); }
+
+        /**
+         * Reclaims on quiescent states instead of epochs, see Epoch::useQuiescentStates: operations
+         * announce nothing, each thread calls quiescent() between batches of them and offline()
+         * before it stops using the tree for a while. Call before the tree is shared.
+         */
+        void reclaimOnQuiescence() { epoch_.useQuiescentStates(); }
+
+        void quiescent() const { ThreadInfo ti(epoch_); epoch_.quiescent(ti); }
+
+        void offline() const { ThreadInfo ti(epoch_); epoch_.offline(ti); }
+
+        /**
+         * Looks up n keys with several descents in flight at once: each round advances one key
+         * by a single level and prefetches the child it will read next, so the cache misses of
+         * different keys overlap. found[i] tells whether out[i] was set.
+         */
+        void lookupBatch(const Key *keys, size_t n, TID *out, bool *found) const;
+
+        bool lookupRange(const Key &k1, const Key &k2, vector<TID> &res) const;
+
+        /**
+         * False only if key is new and the pool is over its budget (ArtObjPool::setBudget), then
+         * the tree is left as it is. The other writes refuse new keys the same way: insertIfAbsent
+         * and upsert then return nullopt without inserting, compareAndSwap false.
+         */
+        bool insert(const Key &key, TID tid);
+
+        /**
+         * Non-unique insert: tid joins the TIDs already under key instead of replacing them.
+         * Secondary indexes can keep their keys as they are rather than appending the TID to them.
+         */
+        bool insertDuplicate(const Key &key, TID tid);
+
+        /* inserts tid unless key exists, in which case its TID is returned and nothing changes */
+        std::optional<TID> insertIfAbsent(const Key &key, TID tid);
+
+        /* sets key to desired only if it holds exactly expected */
+        bool compareAndSwap(const Key &key, TID expected, TID desired);
+
+        /**
+         * Sets key to fn(its TID, or nullopt if absent) and returns the previous TID. fn runs
+         * under the lock of the node holding the leaf, so it has to be short and must not
+         * touch the tree.
+         */
+        std::optional<TID> upsert(const Key &key, const std::function<TID(std::optional<TID>)> &fn);
+
+        /* removes the key with all its TIDs */
+        bool remove(const Key &key);
 
-        void insert(const Key &key, TID tid);
+        /* removes one TID of key, the key goes with its last one */
+        bool removeTid(const Key &key, TID tid);
     };
 }
+extern template class Index::ART<Index::VAR_KEY_LEN>;
 extern template class Index::ART<32>;
 extern template class Index::ART<64>;
 extern template class Index::ART<128>;
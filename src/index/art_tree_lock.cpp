@@ -8,20 +8,20 @@ namespace Index {
 
     template<uint16_t KeyLen>
     ART_Lock<KeyLen>::ART_Lock(Index::ArtObjPool *art_obj_pool) {
-        root_ = new N256();
         art_obj_pool_ = art_obj_pool;
+        root_ = art_obj_pool_->newNode(NT256);
     }
 
     template<uint16_t KeyLen>
     ART_Lock<KeyLen>::~ART_Lock() {
-        //GC(root_);
+        GC(root_);
     }
 
     template<uint16_t KeyLen>
     void ART_Lock<KeyLen>::GC(N* n) {
         if (N::isLeaf(n)) return ;
         std::tuple<uint8_t, N*> children[256];
-        uint16_t len;
+        uint16_t len = 0;
 
         N::getChildren(n, 0, 255, children, len);
         for (uint16_t i = 0; i < len; i++) {
@@ -30,155 +30,207 @@ namespace Index {
                 GC(node);
             }
         }
-        delete n;
+        art_obj_pool_->gcNode(n);
     }
 
     template<uint16_t KeyLen>
     bool ART_Lock<KeyLen>::lookup(const Key &key, TID &tid) const {
-        std::shared_lock<std::shared_mutex> rlk(stx_);
-
-        N *cur;
-        N *parent = nullptr;
+        N *cur = root_;
         uint16_t level = 0;
 
-        cur = root_;
+        cur->latchShared();
         while (key.getKeyLen() > level) {
-            if (checkPrefix(cur, key, level)) { // MATCH
-                parent = cur;
-                cur = N::getChild(parent, key[level]);
-                if (cur == nullptr) {
-                    return false;
-                }
-                if (N::isLeaf(cur) && level == key.getKeyLen() - 1) {
-                    tid = N::getLeaf(cur);
-                    return true;
+            if (!checkPrefix(cur, key, level)) { // NO MATCH
+                break;
+            }
+            N *next = N::getChild(cur, key[level]);
+            if (next == nullptr) {
+                break;
+            }
+            if (N::isLeaf(next)) {
+                bool found = level == key.getKeyLen() - 1;
+                if (found) {
+                    tid = N::getLeaf(next);
                 }
-            } else {   // NO MATCH
-                return false;
+                cur->unlatchShared();
+                return found;
             }
+            next->latchShared();
+            cur->unlatchShared();
+            cur = next;
             level++;
         }
+        cur->unlatchShared();
         return false;
     }
 
     template<uint16_t KeyLen>
     bool ART_Lock<KeyLen>::lookupRange(const Key &k1, const Key &k2, vector<TID> &res) const {
-
-        std::function<void(const N*)> copy = [&](const N* cur) {
-            if (N::isLeaf(cur)) {
-                res.push_back(N::getLeaf(cur));
-            } else {
-                std::tuple<uint8_t, N*> children[256];
-                uint16_t len;
-
-                N::getChildren(cur, 0, 255, children, len);
-                for (uint16_t i = 0; i < len; i++) {
-                    const N* n = std::get<1>(children[i]);
-                    copy(n);
-                }
+        size_t before = res.size();
+        Key from = k1, last;
+        while (true) {
+            root_->latchShared();
+            bool done = scanRange(root_, 0, true, true, from, k2, last, res.size() + SCAN_CHUNK, res);
+            root_->unlatchShared();
+            if (done) {
+                break;
             }
-        };
-
-        std::function<void(const N*, uint16_t&)> find_start = [&](const N* cur, uint16_t& level) {
-            int res = checkPrefix(cur, k1, level);
-            if (res > 0) {
-                return ;
-            } else if (res < 0) {
-                copy(cur);
-            } else {
-                std::tuple<uint8_t, N*> children[256];
-                uint16_t len;
-
-                N::getChildren(cur, k1[level], 255, children, len);
-                for (int i = 0; i < len; i++) {
-                    const N* child = std::get<1>(children[i]);
-                    if (i == 0) {
-                        find_start(child, level);
-                    } else {
-                        copy(child);
-                    }
-                }
+            /* the path was let go, the scan goes on after the last key from the root again */
+            int i = KeyLen - 1;
+            while (i >= 0 && ++last[i] == 0) {
+                i--;
             }
-        };
-
-        std::function<void(const N*, uint16_t&)> find_end = [&](const N* cur, uint16_t& level) {
-            int res = checkPrefix(cur, k1, level);
-            if (res < 0) {
-                return ;
-            } else if (res > 0) {
-                copy(cur);
-            } else {
-                std::tuple<uint8_t, N*> children[256];
-                uint16_t len;
-
-                N::getChildren(cur, 0, k1[level], children, len);
-                for (int i = 0; i < len; i++) {
-                    const N* child = std::get<1>(children[i]);
-                    if (i == len - 1) {
-                        find_end(child, level);
-                    } else {
-                        copy(child);
-                    }
-                }
+            if (i < 0) {
+                break;
             }
-        };
+            from = last;
+        }
+        return res.size() > before;
+    }
 
-        uint16_t level = 0;
-        N* cur = root_;
-        N* parent;
-        uint16_t start_key, end_key;
+    template<uint16_t KeyLen>
+    bool ART_Lock<KeyLen>::scanRange(const N *n, uint16_t level, bool lo, bool hi, const Key &k1, const Key &k2,
+                                     Key &last, size_t limit, vector<TID> &res) const {
+        for (int i = 0; i < n->getPrefixLen(); i++, level++) {
+            uint8_t p = n->getPrefix()[i];
+            if ((lo && p < k1[level]) || (hi && p > k2[level])) { /* the whole subtree is outside */
+                return true;
+            }
+            lo = lo && p == k1[level];
+            hi = hi && p == k2[level];
+            last[level] = p;
+        }
 
-        while (true) {
-            if (checkPrefix(cur, k1, k2, level, start_key, end_key)) {
-                std::tuple<uint8_t, N*> children[256];
-                uint16_t len;
-
-                N::getChildren(cur, start_key, end_key, children, len);
-
-                if (len >= 2) {
-                    for (int i = 0; i < len; ++i) {
-                        const N *n = std::get<1>(children[i]);
-                        if (i == 0) {
-                            uint16_t level_copy = level;
-                            find_start(n, level_copy);
-                        } else if (i == len - 1) {
-                            uint16_t level_copy = level;
-                            find_end(n, level_copy);
-                        } else {
-                            copy(n);
-                        }
-                    }
-                } else if (len == 1) {
-                    parent = cur;
-                    cur = N::getChild(parent, start_key);
-                } else {
+        uint8_t k;
+        uint16_t end = hi ? k2[level] : 255;
+        for (N *child = N::getNextChild(n, lo ? k1[level] : 0, k); child != nullptr && k <= end;
+             child = N::getNextChild(n, k + 1, k)) {
+            last[level] = k;
+            if (N::isLeaf(child)) {
+                res.push_back(N::getLeaf(child));
+                if (res.size() >= limit) {
                     return false;
                 }
-            } else {
+                continue;
+            }
+            child->latchShared();
+            bool done = scanRange(child, level + 1, lo && k == k1[level], hi && k == k2[level], k1, k2, last, limit, res);
+            child->unlatchShared();
+            if (!done) {
                 return false;
             }
-            level++;
         }
+        return true;
     }
 
     template<uint16_t KeyLen>
     void ART_Lock<KeyLen>::insert(const Key &key, TID tid) {
-        std::unique_lock<std::shared_mutex> rlk(stx_);
+        for (int i = 0; i < SHARED_INSERT_TRIES; i++) {
+            if (insertShared(key, tid)) {
+                return;
+            }
+        }
+        insertExclusive(key, tid);
+    }
 
-        N *cur = nullptr;
-        N *next = root_;
-        N *parent;
-        uint8_t pk = 0, k = 0;
+    template<uint16_t KeyLen>
+    bool ART_Lock<KeyLen>::insertShared(const Key &key, TID tid) {
+        N *cur = root_;
+        N *parent = nullptr;
+        uint8_t pk = 0;
         uint16_t level = 0;
-        uint8_t remainPrefix[MAX_PREFIX_LEN];
+        uint8_t remainPrefix[Key::MAX_LEN];
         uint8_t no_match_key = 0, remain_prefix_len = 0;
 
+        cur->latchShared();
         while (level < key.getKeyLen()) {
-            parent = cur;
-            pk = k;
+            uint16_t nextLevel = level;
+            if (!checkPrefix(cur, key, nextLevel, no_match_key, remainPrefix, remain_prefix_len)) { /* No Match */
+                if (!parent->tryUpgradeLatch()) {
+                    cur->unlatchShared();
+                    parent->unlatchShared();
+                    return false;
+                }
+                if (!cur->tryUpgradeLatch()) {
+                    cur->unlatchShared();
+                    parent->unlatchExclusive();
+                    return false;
+                }
+                N *newNode = art_obj_pool_->newNode(NT4);
+                N *nextNode = GenNewNode(key, nextLevel + 1, tid);
+                newNode->setPrefix(cur->getPrefix(), nextLevel - level);
+                cur->setPrefix(remainPrefix, remain_prefix_len);
 
-            cur = next;
+                N::setChild(newNode, no_match_key, cur);
+                N::setChild(newNode, key[nextLevel], nextNode);
+                N::changeChild(parent, pk, newNode);
+                cur->unlatchExclusive();
+                parent->unlatchExclusive();
+                return true;
+            }
 
+            uint8_t k = key[nextLevel];
+            N *next = N::getChild(cur, k);
+            if (parent != nullptr && (next != nullptr || !cur->isFull())) { /* cur stays where it is */
+                parent->unlatchShared();
+                parent = nullptr;
+            }
+            if (next != nullptr && !N::isLeaf(next)) {
+                next->latchShared();
+                parent = cur;
+                pk = k;
+                cur = next;
+                level = nextLevel + 1;
+                continue;
+            }
+
+            /* cur changes, and its parent too if it grows */
+            if (parent != nullptr && !parent->tryUpgradeLatch()) {
+                cur->unlatchShared();
+                parent->unlatchShared();
+                return false;
+            }
+            if (!cur->tryUpgradeLatch()) {
+                cur->unlatchShared();
+                if (parent != nullptr) {
+                    parent->unlatchExclusive();
+                }
+                return false;
+            }
+            if (next == nullptr) { /* Specific Slot is NULL */
+                if (cur->isFull()) {
+                    N::insertAndGrow(cur, parent, pk, k, GenNewNode(key, nextLevel + 1, tid), art_obj_pool_);
+                    cur->unlatchExclusive();
+                    parent->unlatchExclusive();
+                    art_obj_pool_->gcNode(cur);
+                } else {
+                    N::setChild(cur, k, GenNewNode(key, nextLevel + 1, tid));
+                    cur->unlatchExclusive();
+                }
+            } else { /* The Same Key is thought as Update */
+                N::changeChild(cur, k, (N *) N::convertToLeaf(tid));
+                cur->unlatchExclusive();
+            }
+            return true;
+        }
+        if (parent != nullptr) {
+            parent->unlatchShared();
+        }
+        cur->unlatchShared();
+        return true;
+    }
+
+    template<uint16_t KeyLen>
+    void ART_Lock<KeyLen>::insertExclusive(const Key &key, TID tid) {
+        N *cur = root_;
+        N *parent = nullptr;
+        uint8_t pk = 0;
+        uint16_t level = 0;
+        uint8_t remainPrefix[Key::MAX_LEN];
+        uint8_t no_match_key = 0, remain_prefix_len = 0;
+
+        cur->latchExclusive();
+        while (level < key.getKeyLen()) {
             uint16_t nextLevel = level;
             if (!checkPrefix(cur, key, nextLevel, no_match_key, remainPrefix, remain_prefix_len)) { /* No Match */
                 N *newNode = art_obj_pool_->newNode(NT4);
@@ -189,28 +241,45 @@ namespace Index {
                 N::setChild(newNode, no_match_key, cur);
                 N::setChild(newNode, key[nextLevel], nextNode);
                 N::changeChild(parent, pk, newNode);
+                cur->unlatchExclusive();
+                parent->unlatchExclusive();
                 return;
             }
 
-            k = key[nextLevel];
-            if (!N::getChild(cur, k)) { /* Specific Slot is NULL */
+            uint8_t k = key[nextLevel];
+            N *next = N::getChild(cur, k);
+            if (parent != nullptr && (next != nullptr || !cur->isFull())) { /* cur stays where it is */
+                parent->unlatchExclusive();
+                parent = nullptr;
+            }
+            if (next == nullptr) { /* Specific Slot is NULL */
                 if (cur->isFull()) {
                     N::insertAndGrow(cur, parent, pk, k, GenNewNode(key, nextLevel + 1, tid), art_obj_pool_);
+                    cur->unlatchExclusive();
+                    parent->unlatchExclusive();
                     art_obj_pool_->gcNode(cur);
                 } else {
                     N::setChild(cur, k, GenNewNode(key, nextLevel + 1, tid));
+                    cur->unlatchExclusive();
                 }
                 return;
-            } else {
-                next = N::getChild(cur, k);
-
-                if (N::isLeaf(next)) { /* The Same Key is thought as Update */
-                    N::changeChild(cur, k, (N *) N::convertToLeaf(tid));
-                    return;
-                }
             }
+            if (N::isLeaf(next)) { /* The Same Key is thought as Update */
+                N::changeChild(cur, k, (N *) N::convertToLeaf(tid));
+                cur->unlatchExclusive();
+                return;
+            }
+
+            next->latchExclusive();
+            parent = cur;
+            pk = k;
+            cur = next;
             level = nextLevel + 1;
         }
+        if (parent != nullptr) {
+            parent->unlatchExclusive();
+        }
+        cur->unlatchExclusive();
     }
 
 }
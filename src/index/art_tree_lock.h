@@ -3,7 +3,7 @@
 #include <vector>
 #include <iostream>
 #include <algorithm>
-#include <shared_mutex>
+#include <functional>
 
 #include "sched.h"
 #include "emmintrin.h"
@@ -16,6 +16,17 @@
 
 namespace Index {
 
+    /**
+     * Pessimistic baseline next to ART: every node carries a reader-writer latch (N::latchShared)
+     * and operations couple them hand over hand from the root, taking a child's latch before
+     * letting go of its parent. Readers latch shared. Writers descend shared as well, keeping
+     * the parent only while the node below may still have to be split or grown, which replaces
+     * it in the parent, and upgrade just the latches of the nodes they change. An upgrade fails
+     * if another thread holds the node, then the writer lets go of all and traverses again; after
+     * SHARED_INSERT_TRIES such rounds it latches exclusive hand over hand from the root, which
+     * always gets through. As nobody can be on the way to a replaced node, it goes back to the
+     * pool at once.
+     */
     template<uint16_t KeyLen>
     class ART_Lock {
         using Key = KEY<KeyLen>;
@@ -34,10 +45,27 @@ namespace Index {
 
         Index::ArtObjPool *art_obj_pool_ = nullptr;
 
-        mutable std::shared_mutex stx_;
+        static const int SHARED_INSERT_TRIES = 4;
 
         void GC(N* n);
 
+        /* false if a latch could not be upgraded, all latches are let go then and nothing changed */
+        bool insertShared(const Key &key, TID tid);
+
+        void insertExclusive(const Key &key, TID tid);
+
+        /* TIDs a range scan collects before it lets go of its path and seeks again */
+        static const size_t SCAN_CHUNK = 256;
+
+        /**
+         * Appends the TIDs below n, latched shared by the caller, that lie in [k1, k2]. lo and hi
+         * tell whether the bytes above level still equal those of k1 and k2. The latches of the
+         * path stay held while the subtree is visited, so once res holds limit TIDs it stops and
+         * returns false, with the key of the last one in last.
+         */
+        bool scanRange(const N *n, uint16_t level, bool lo, bool hi, const Key &k1, const Key &k2,
+                       Key &last, size_t limit, vector<TID> &res) const;
+
     public:
         ART_Lock(Index::ArtObjPool *art_obj_pool);
 
@@ -56,7 +84,7 @@ namespace Index {
         bool checkPrefix(const N* n, const Key &start, const Key &end, uint16_t &level,
                          uint16_t& k1, uint16_t& k2) const {
             uint8_t start_key, end_key;
-            k1 = k2 = -1;
+            k1 = k2 = UINT16_MAX;
             for (int i = 0; i < n->getPrefixLen(); i++) {
                 start_key = start[level];
                 end_key = end[level];
@@ -70,8 +98,8 @@ namespace Index {
                 }
                 level++;
             }
-            if (k1 == -1) k1 = start[level];
-            if (k2 == -1) k2 = end[level];
+            if (k1 == UINT16_MAX) k1 = start[level];
+            if (k2 == UINT16_MAX) k2 = end[level];
             return true;
         }
 
@@ -96,7 +124,7 @@ namespace Index {
             uint8_t p_len;
 
             if (level < key.getKeyLen()) {
-                n = new N4();
+                n = art_obj_pool_->newNode(NT4);
                 p_len = min(MAX_PREFIX_LEN, key.getKeyLen() - level - 1);
                 n->setPrefix((uint8_t *) &key[level], p_len);
                 level += p_len;
@@ -110,7 +138,12 @@ namespace Index {
 
         bool lookup(const Key &key, TID &tid) const;
 
-        bool lookupRange(const Key &k1, const Key &k2, vector<TID> &res) const ;
+        /**
+         * TIDs of all keys in [k1, k2], in key order. Every SCAN_CHUNK TIDs the scan releases its
+         * latches and seeks the key after the last one from the root, so writers are held up by
+         * one chunk at most. Keys inserted meanwhile show up if they sort after that key.
+         */
+        bool lookupRange(const Key &k1, const Key &k2, vector<TID> &res) const;
 
         void insert(const Key &key, TID tid);
     };
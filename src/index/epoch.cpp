@@ -1,8 +1,10 @@
 #include "epoch.h"
+#include "art_obj_pool.h"
+#include <algorithm>
 #include <iostream>
 
 namespace Index {
-    inline DeletionList::~DeletionList() {
+    DeletionList::~DeletionList() {
         LabelDelete* cur = nullptr, *next = free_;
         while (next != nullptr) {
             cur = next;
@@ -12,11 +14,11 @@ namespace Index {
         free_ = nullptr;
     }
 
-    inline std::size_t DeletionList::size() {
+    std::size_t DeletionList::size() {
         return deletionListCount;
     }
 
-    inline void DeletionList::remove(LabelDelete *label, LabelDelete *prev) {
+    void DeletionList::remove(LabelDelete *label, LabelDelete *prev) {
         if (prev == nullptr)
             head_ = label->next;
         else
@@ -29,7 +31,7 @@ namespace Index {
         deleted += label->nodesCount;
     }
 
-    inline void DeletionList::add(void *n, uint64_t globalEpoch) {
+    void DeletionList::add(void *n, uint64_t globalEpoch) {
         deletionListCount++;
         LabelDelete* label;
         if (head_ != nullptr && head_->nodesCount < head_->nodes.size()) {
@@ -51,94 +53,388 @@ namespace Index {
         added++;
     }
 
-    inline LabelDelete* DeletionList::head() {
+    LabelDelete* DeletionList::head() {
         return head_;
     }
 
-    inline void Epoch::enterEpoch(ThreadInfo &ti) {
-        uint64_t current = currentEpoch.load(std::memory_order_relaxed);
-        ti.getDeletionList().localEpoch.store(current, std::memory_order_release);
+    LabelDelete* DeletionList::takeAll() {
+        LabelDelete* labels = head_;
+        head_ = nullptr;
+        deletionListCount = 0;
+        return labels;
     }
 
-    inline void Epoch::markNodeForDeletion(void *n, ThreadInfo &ti) {
-        ti.getDeletionList().add(n, currentEpoch.load());
-        ti.getDeletionList().threshold++;
+    uint64_t DeletionList::oldest() {
+        uint64_t epoch = std::numeric_limits<uint64_t>::max();
+        for (LabelDelete* cur = head_; cur != nullptr; cur = cur->next) {
+            epoch = cur->epoch;
+        }
+        return epoch;
     }
 
-    inline void Epoch::exitEpochAndCleanup(ThreadInfo &ti) {
-        DeletionList &deletionList = ti.getDeletionList();
-        if ((deletionList.threshold & (64 - 1)) == 1) {
-            currentEpoch++;
+    void DeletionList::splice(LabelDelete *labels) {
+        LabelDelete** tail = &head_;
+        while (*tail != nullptr) {
+            tail = &(*tail)->next;
+        }
+        *tail = labels;
+        for (; labels != nullptr; labels = labels->next) {
+            deletionListCount += labels->nodesCount;
+        }
+    }
+
+    void DeletionList::recycle(LabelDelete *labels) {
+        while (labels != nullptr) {
+            LabelDelete* next = labels->next;
+            labels->next = free_;
+            free_ = labels;
+            labels = next;
+        }
+    }
+
+    /**
+     * The lists the calling thread used, by epoch. When the thread exits their nodes are left to
+     * the epochs, which could otherwise only free them once destroyed.
+     */
+    struct ThreadExitHook {
+        std::vector<std::pair<std::shared_ptr<Epoch::Orphans>, DeletionList*>> lists;
+
+        /* also drops the lists of epochs destroyed since, so a thread using many trees keeps few */
+        void add(const std::shared_ptr<Epoch::Orphans>& orphans, DeletionList* deletionList) {
+            lists.erase(std::remove_if(lists.begin(), lists.end(), [](auto& entry) {
+                std::lock_guard<std::mutex> guard(entry.first->lock);
+                return entry.first->epoch == nullptr;
+            }), lists.end());
+            lists.emplace_back(orphans, deletionList);
         }
-        if (deletionList.threshold > startGCThreshold) {
-            if (deletionList.size() == 0) {
-                deletionList.threshold = 0;
-                return ;
-            }
-            deletionList.localEpoch.store(std::numeric_limits<uint64_t>::max());
 
-            uint64_t oldestEpoch = std::numeric_limits<uint64_t>::max();
-            for (auto& deletion : deletionLists) {
-                auto e = deletion.localEpoch.load();
-                if (e < oldestEpoch) {
-                    oldestEpoch = e;
+        ~ThreadExitHook() {
+            for (auto& [orphans, deletionList] : lists) {
+                std::lock_guard<std::mutex> guard(orphans->lock);
+                if (orphans->epoch != nullptr) {
+                    orphans->epoch->orphan(*deletionList);
                 }
             }
+        }
+    };
 
-            LabelDelete* cur = deletionList.head(), *next, *prev = nullptr;
-            while (cur != nullptr) {
-                next = cur->next;
+    static thread_local ThreadExitHook threadExitHook;
+
+    void Epoch::orphan(DeletionList &deletionList) {
+        /* an exiting thread reads nothing any more, under QSBR too */
+        deletionList.slot->epoch.store(EpochSlot::IDLE, std::memory_order_release);
+        deletionList.exitHooked = false;
+        if (deletionList.size() == 0) {
+            return;
+        }
+        if (background_) {
+            handOff(deletionList);
+            return;
+        }
+        LabelDelete* labels = deletionList.takeAll();
+        LabelDelete* last = labels;
+        while (last->next != nullptr) {
+            last = last->next;
+        }
+        last->next = orphans_->labels;
+        orphans_->labels = labels;
+        orphans_->any.store(true, std::memory_order_release);
+    }
 
-                if (cur->epoch < oldestEpoch) {
-                    for (std::size_t i = 0; i < cur->nodesCount; ++i) {
-                        operator delete(cur->nodes[i]);
-                    }
-                    deletionList.remove(cur, prev);
+    void Epoch::adoptOrphans(DeletionList &deletionList) {
+        LabelDelete* labels;
+        {
+            std::lock_guard<std::mutex> guard(orphans_->lock);
+            labels = orphans_->labels;
+            orphans_->labels = nullptr;
+            orphans_->any.store(false, std::memory_order_relaxed);
+        }
+        deletionList.splice(labels);
+    }
+
+    EpochSlot* Epoch::registerThread() {
+        size_t index = registered_.fetch_add(1);
+        SlotBlock* block = &slots_;
+        for (size_t b = index / SLOTS_PER_BLOCK; b > 0; b--) {
+            SlotBlock* next = block->next.load(std::memory_order_acquire);
+            if (next == nullptr) {
+                auto* fresh = new SlotBlock();
+                if (block->next.compare_exchange_strong(next, fresh)) {
+                    next = fresh;
                 } else {
-                    prev = cur;
+                    delete fresh;
                 }
-                cur = next;
             }
+            block = next;
+        }
+        return &block->slots[index % SLOTS_PER_BLOCK];
+    }
+
+    uint64_t Epoch::scan() {
+        /* read first: a thread not seen below enters at this epoch or a later one */
+        uint64_t safe = currentEpoch.load();
+        for (SlotBlock* block = &slots_; block != nullptr; block = block->next.load(std::memory_order_acquire)) {
+            for (auto& slot : block->slots) {
+                uint64_t e = slot.epoch.load();
+                if (e < safe) {
+                    safe = e;
+                }
+            }
+        }
+        /* a bound stays true as the epoch moves on, so the cache only grows */
+        uint64_t cached = safeEpoch_.load(std::memory_order_relaxed);
+        while (cached < safe && !safeEpoch_.compare_exchange_weak(cached, safe, std::memory_order_relaxed));
+        return std::max(cached, safe);
+    }
+
+    uint64_t Epoch::safeEpoch(uint64_t needed) {
+        uint64_t safe = safeEpoch_.load(std::memory_order_relaxed);
+        return safe > needed ? safe : scan();
+    }
+
+    void Epoch::enterEpoch(ThreadInfo &ti) {
+        DeletionList &deletionList = ti.getDeletionList();
+        if (deletionList.nesting++ > 0) {
+            return;
+        }
+        if (qsbr_) { /* coming back online: from here on it may read nodes retired at this epoch */
+            if (deletionList.slot->epoch.load(std::memory_order_relaxed) == EpochSlot::IDLE) {
+                deletionList.slot->epoch.store(currentEpoch.load(std::memory_order_relaxed), std::memory_order_seq_cst);
+            }
+            return;
+        }
+        uint64_t current = currentEpoch.load(std::memory_order_relaxed);
+        // must be visible before this thread reads any node, so no store-load reordering here
+        deletionList.slot->epoch.store(current, std::memory_order_seq_cst);
+    }
+
+    void Epoch::reclaim(void *n) {
+        if (N::isLeaf(static_cast<N *>(n))) { /* retired leaves are passed tagged */
+            if (pool_ != nullptr) {
+                pool_->leafFreed(N::leafBytes(static_cast<N *>(n)));
+            }
+            N::releaseLeaf(static_cast<N *>(n));
+        } else if (pool_ != nullptr) {
+            pool_->gcNode(static_cast<N *>(n));
+        } else {
+            N::deleteNode(static_cast<N *>(n));
+        }
+    }
+
+    void Epoch::markNodeForDeletion(void *n, ThreadInfo &ti) {
+        DeletionList &deletionList = ti.getDeletionList();
+        deletionList.add(n, currentEpoch.load());
+        if (++deletionList.threshold % ADVANCE_EVERY == 0) {
+            currentEpoch.fetch_add(1);
+        }
+    }
+
+    void Epoch::exitEpochAndCleanup(ThreadInfo &ti) {
+        DeletionList &deletionList = ti.getDeletionList();
+        if (--deletionList.nesting > 0) {
+            return;
+        }
+        if (qsbr_) {
+            return;
+        }
+        deletionList.slot->epoch.store(EpochSlot::IDLE, std::memory_order_release);
+        if (deletionList.threshold > startGCThreshold) {
+            collect(deletionList);
+        }
+    }
+
+    void Epoch::collect(DeletionList &deletionList) {
+        if (orphans_->any.load(std::memory_order_acquire)) {
+            adoptOrphans(deletionList);
+        }
+        if (deletionList.size() == 0) {
+            deletionList.threshold = 0;
+            return ;
+        }
+        if (background_) {
+            handOff(deletionList);
             deletionList.threshold = 0;
+            return;
+        }
+        /* the nodes retired last carry the current epoch, move on so they can go next time */
+        currentEpoch.fetch_add(1);
+        uint64_t oldestEpoch = safeEpoch(deletionList.oldest());
+
+        LabelDelete* cur = deletionList.head(), *next, *prev = nullptr;
+        while (cur != nullptr) {
+            next = cur->next;
+
+            if (cur->epoch < oldestEpoch) {
+                for (std::size_t i = 0; i < cur->nodesCount; ++i) {
+                    reclaim(cur->nodes[i]);
+                }
+                deletionList.remove(cur, prev);
+            } else {
+                prev = cur;
+            }
+            cur = next;
+        }
+        deletionList.threshold = 0;
+    }
+
+    void Epoch::useQuiescentStates() {
+        qsbr_ = true;
+    }
+
+    void Epoch::quiescent(ThreadInfo &ti) {
+        DeletionList &deletionList = ti.getDeletionList();
+        ASSERT(deletionList.nesting == 0, "a thread inside an operation is not quiescent");
+        deletionList.slot->epoch.store(currentEpoch.load(std::memory_order_relaxed), std::memory_order_seq_cst);
+        if (deletionList.threshold > startGCThreshold) {
+            collect(deletionList);
         }
     }
 
+    void Epoch::offline(ThreadInfo &ti) {
+        ASSERT(ti.getDeletionList().nesting == 0, "a thread inside an operation can not go offline");
+        ti.getDeletionList().slot->epoch.store(EpochSlot::IDLE, std::memory_order_release);
+    }
+
     Epoch::~Epoch() {
-        uint64_t oldestEpoch = std::numeric_limits<uint64_t>::max();
-        for (auto& deletion : deletionLists) {
-            auto e= deletion.localEpoch.load();
-            if (e < oldestEpoch) {
-                oldestEpoch = e;
+        {
+            std::lock_guard<std::mutex> guard(orphans_->lock);
+            orphans_->epoch = nullptr;
+        }
+        if (background_) {
+            stop_.store(true, std::memory_order_release);
+            reclaimer_.join();
+            reclaimPending(0, true);
+            while (spare_ != nullptr) {
+                LabelDelete* next = spare_->next;
+                delete spare_;
+                spare_ = next;
             }
         }
+        if (!deletionLists.empty()) {
+            adoptOrphans(*deletionLists.begin());
+        }
         for (auto& d : deletionLists) {
             LabelDelete *cur = d.head(), *next, *prev = nullptr;
             while (cur != nullptr) {
                 next = cur->next;
 
                 for (std::size_t i = 0; i < cur->nodesCount; ++i) {
-                    operator delete(cur->nodes[i]);
+                    reclaim(cur->nodes[i]);
                 }
                 d.remove(cur, prev);
                 cur = next;
             }
         }
+        SlotBlock* block = slots_.next.load();
+        while (block != nullptr) {
+            SlotBlock* next = block->next.load();
+            delete block;
+            block = next;
+        }
     }
 
-    inline void Epoch::showDeleteRatio() {
+    void Epoch::showDeleteRatio() {
         for (auto &d : deletionLists) {
             std::cout << "deleted " << d.deleted << " of " << d.added << std::endl;
         }
+        if (background_) {
+            std::cout << "deleted " << reclaimedInBackground_.load() << " in the background" << std::endl;
+        }
+    }
+
+    void Epoch::startReclaimer(std::chrono::microseconds interval) {
+        background_ = true;
+        reclaimer_ = std::thread([this, interval] { reclaimLoop(interval); });
+    }
+
+    void Epoch::handOff(DeletionList &deletionList) {
+        LabelDelete* first = deletionList.takeAll();
+        LabelDelete* last = first;
+        while (last->next != nullptr) {
+            last = last->next;
+        }
+        LabelDelete* head = handedOff_.load(std::memory_order_relaxed);
+        do {
+            last->next = head;
+        } while (!handedOff_.compare_exchange_weak(head, first, std::memory_order_release));
+
+        /* the labels the reclaimer emptied since, so the next ones are not new allocations */
+        LabelDelete* spare;
+        {
+            std::lock_guard<std::mutex> guard(spareLock_);
+            spare = spare_;
+            spare_ = nullptr;
+        }
+        deletionList.recycle(spare);
+    }
+
+    void Epoch::reclaimLoop(std::chrono::microseconds interval) {
+        while (!stop_.load(std::memory_order_acquire)) {
+            std::this_thread::sleep_for(interval);
+            currentEpoch++;
+            reclaimPending(0, false);
+        }
+    }
+
+    void Epoch::reclaimPending(uint64_t oldest, bool force) {
+        LabelDelete* in = handedOff_.exchange(nullptr, std::memory_order_acquire);
+        while (in != nullptr) {
+            LabelDelete* next = in->next;
+            in->next = pending_;
+            pending_ = in;
+            in = next;
+        }
+        if (!force) { /* only after taking the labels, whose nodes were unlinked before they were handed off */
+            oldest = scan();
+        }
+
+        LabelDelete* keep = nullptr, *done = nullptr;
+        std::size_t count = 0;
+        while (pending_ != nullptr) {
+            LabelDelete* cur = pending_;
+            pending_ = cur->next;
+            if (force || cur->epoch < oldest) {
+                for (std::size_t i = 0; i < cur->nodesCount; ++i) {
+                    reclaim(cur->nodes[i]);
+                }
+                count += cur->nodesCount;
+                cur->next = done;
+                done = cur;
+            } else {
+                cur->next = keep;
+                keep = cur;
+            }
+        }
+        pending_ = keep;
+        reclaimedInBackground_ += count;
+
+        if (done != nullptr) {
+            std::lock_guard<std::mutex> guard(spareLock_);
+            LabelDelete* last = done;
+            while (last->next != nullptr) {
+                last = last->next;
+            }
+            last->next = spare_;
+            spare_ = done;
+        }
     }
 
-    inline ThreadInfo::ThreadInfo(Epoch &epoch)
-            : epoch(epoch), deletionList(epoch.deletionLists.local()) { }
+    ThreadInfo::ThreadInfo(Epoch &epoch)
+            : epoch(epoch), deletionList(epoch.deletionLists.local()) {
+        if (deletionList.slot == nullptr) {
+            deletionList.slot = epoch.registerThread();
+        }
+        if (!deletionList.exitHooked) { /* a thread reusing an exited one's id gets its list */
+            deletionList.exitHooked = true;
+            threadExitHook.add(epoch.orphans_, &deletionList);
+        }
+    }
 
-    inline DeletionList &ThreadInfo::getDeletionList() const {
+    DeletionList &ThreadInfo::getDeletionList() const {
         return deletionList;
     }
 
-    inline Epoch &ThreadInfo::getEpoch() const {
+    Epoch &ThreadInfo::getEpoch() const {
         return epoch;
     }
 }
\ No newline at end of file
@@ -2,11 +2,18 @@
 
 #include <atomic>
 #include <array>
+#include <chrono>
+#include <limits>
+#include <memory>
+#include <mutex>
+#include <thread>
 #include "tbb/enumerable_thread_specific.h"
 #include "tbb/combinable.h"
 
 namespace Index {
 
+    class ArtObjPool;
+
     struct LabelDelete {
         std::array<void*, 32> nodes;
         uint64_t epoch;
@@ -14,14 +21,26 @@ namespace Index {
         LabelDelete* next;
     };
 
+    /* epoch a thread announces while inside, alone on its cache line; IDLE outside */
+    struct alignas(64) EpochSlot {
+        static const uint64_t IDLE = std::numeric_limits<uint64_t>::max();
+
+        std::atomic<uint64_t> epoch{IDLE};
+    };
+
     class DeletionList {
         LabelDelete* head_ = nullptr;
         LabelDelete* free_ = nullptr;
         std::size_t deletionListCount = 0;
 
     public:
-        std::atomic<uint64_t> localEpoch;
+        /* the slot this thread got when it first used the epoch, only it writes there */
+        EpochSlot* slot = nullptr;
         size_t threshold = 0;
+        // guards of the same thread may nest (an open iterator plus point operations)
+        uint32_t nesting = 0;
+        /* given up to the epoch when the thread using it exits, see Epoch::orphan */
+        bool exitHooked = false;
 
         ~DeletionList();
         LabelDelete* head();
@@ -30,6 +49,18 @@ namespace Index {
 
         void remove(LabelDelete* label, LabelDelete* prev);
 
+        /* hands over all labels, full or not, the list is empty afterwards */
+        LabelDelete* takeAll();
+
+        /* epoch of the oldest label, labels are added at the head */
+        uint64_t oldest();
+
+        /* labels to fill before allocating new ones */
+        void recycle(LabelDelete* labels);
+
+        /* adds labels full of nodes, behind the ones already here */
+        void splice(LabelDelete* labels);
+
         std::size_t size();
 
         std::size_t deleted = 0;
@@ -51,21 +82,106 @@ namespace Index {
     public:
         ThreadInfo(Epoch& e);
         ThreadInfo(const ThreadInfo& ti) : epoch(ti.epoch), deletionList(ti.deletionList) {}
-        ~ThreadInfo();
 
         Epoch& getEpoch() const;
     };
 
+    /**
+     * Threads announce the epoch they are in through slots of their own, registered on first
+     * use, so entering and leaving is one store to a line no other thread writes. The global
+     * epoch moves once every ADVANCE_EVERY nodes a thread retires and before each collection,
+     * not per operation. Collections first try safeEpoch_, the last bound any thread found
+     * below every announced epoch, and only scan the slots when their oldest nodes are younger.
+     */
     class Epoch {
         friend class ThreadInfo;
-        std::atomic<uint64_t> currentEpoch{0};
+
+        static const size_t ADVANCE_EVERY = 64;
+
+        static const size_t SLOTS_PER_BLOCK = 64;
+
+        struct SlotBlock {
+            EpochSlot slots[SLOTS_PER_BLOCK];
+            std::atomic<SlotBlock*> next{nullptr};
+        };
+
+        alignas(64) std::atomic<uint64_t> currentEpoch{0};
+
+        alignas(64) std::atomic<uint64_t> safeEpoch_{0};
+
+        SlotBlock slots_;
+        std::atomic<size_t> registered_{0};
+
+        EpochSlot* registerThread();
+
+        /* a bound below the epoch of every thread inside now or entering later */
+        uint64_t scan();
+
+        /* safeEpoch_, or a fresh scan if that does not reach past needed */
+        uint64_t safeEpoch(uint64_t needed);
 
         tbb::enumerable_thread_specific<DeletionList> deletionLists;
 
         size_t startGCThreshold;
 
+        /* nodes are handed back here instead of being freed, if set */
+        ArtObjPool *pool_ = nullptr;
+
+        void reclaim(void *n);
+
+        /**
+         * Background reclamation, see startReclaimer. Workers push their labels onto handedOff_,
+         * the reclaimer moves them to pending_ until their epoch is safe and then parks the empty
+         * labels in spare_ for the workers to fill again.
+         */
+        bool background_ = false;
+        std::thread reclaimer_;
+        std::atomic<bool> stop_{false};
+        std::atomic<LabelDelete*> handedOff_{nullptr};
+        LabelDelete* pending_ = nullptr;    // only touched by the reclaimer
+        std::mutex spareLock_;
+        LabelDelete* spare_ = nullptr;
+        std::atomic<std::size_t> reclaimedInBackground_{0};
+
+        void handOff(DeletionList& deletionList);
+
+        void reclaimLoop(std::chrono::microseconds interval);
+
+        /* frees the pending labels below oldest, all of them if force */
+        void reclaimPending(uint64_t oldest, bool force);
+
+        /* see useQuiescentStates */
+        bool qsbr_ = false;
+
+        /**
+         * Labels of threads that have exited, which no thread would collect any more. Exiting
+         * threads leave theirs here through a thread_local hook holding this by shared_ptr, so
+         * it outlives the epoch, which closes it first thing when destroyed.
+         */
+        struct Orphans {
+            std::mutex lock;
+            Epoch* epoch;   // nullptr once closed
+            LabelDelete* labels = nullptr;
+            std::atomic<bool> any{false};
+
+            explicit Orphans(Epoch* epoch) : epoch(epoch) {}
+        };
+        std::shared_ptr<Orphans> orphans_ = std::make_shared<Orphans>(this);
+
+        /* called for a thread's list when the thread exits, with orphans_->lock held */
+        void orphan(DeletionList& deletionList);
+
+        /* moves the orphaned labels to deletionList, so its collections free them too */
+        void adoptOrphans(DeletionList& deletionList);
+
+        /* frees what no thread can reach any more of the nodes deletionList holds, or hands them off */
+        void collect(DeletionList& deletionList);
+
+        friend struct ThreadExitHook;
+
     public:
         Epoch(size_t startGCThreshold) : startGCThreshold(startGCThreshold) {}
+        Epoch(size_t startGCThreshold, ArtObjPool *pool) : startGCThreshold(startGCThreshold), pool_(pool) {}
         ~Epoch();
 
         void enterEpoch(ThreadInfo& ti);
@@ -75,6 +191,31 @@ namespace Index {
         void exitEpochAndCleanup(ThreadInfo &ti);
 
         void showDeleteRatio();
+
+        /**
+         * Takes reclamation off the threads using the epoch: once a thread has retired enough
+         * nodes it hands its labels over whole, and a background thread advancing the epoch every
+         * interval gives back the nodes no reader can still reach, to the pool if there is one.
+         * The workers then never scan the other threads or free anything themselves. Call once,
+         * before any thread enters the epoch.
+         */
+        void startReclaimer(std::chrono::microseconds interval = std::chrono::microseconds(1000));
+
+        /**
+         * Quiescent-state-based reclamation: guards no longer announce anything, a thread is
+         * online from its first operation and its slot holds the epoch of its last quiescent
+         * call, where it promises to hold no node it read before. Nodes retired before every
+         * online thread passed such a point are freed as usual, also by the reclaimer. A thread
+         * that stays online without calling quiescent holds back all reclamation, so threads call
+         * offline before they pause or exit. Call once, before any thread enters the epoch.
+         */
+        void useQuiescentStates();
+
+        /* between operations only, collects too once enough nodes are retired */
+        void quiescent(ThreadInfo& ti);
+
+        /* until the next operation of this thread */
+        void offline(ThreadInfo& ti);
     };
 
     class EpochGuard {
@@ -89,8 +230,4 @@ namespace Index {
         }
     };
 
-    inline ThreadInfo::~ThreadInfo() {
-        deletionList.localEpoch.store(std::numeric_limits<uint64_t>::max());
-    }
-
 }
@@ -0,0 +1,187 @@
+#include "index_builder.h"
+
+#include "tbb/parallel_for.h"
+#include "tbb/blocked_range.h"
+#include "tbb/task_arena.h"
+
+namespace Index {
+
+    template<uint16_t KeyLen>
+    IndexBuilder<KeyLen>::IndexBuilder(ART<KeyLen> *tree) : IndexBuilder(tree, false) {
+        ASSERT(tree->root_->getCount() == 0, "bulk load needs an empty tree");
+    }
+
+    template<uint16_t KeyLen>
+    IndexBuilder<KeyLen>::IndexBuilder(ART<KeyLen> *tree, bool detached) : tree_(tree), detached_(detached) {
+        frames_.resize(1);
+        frames_[0].level = 0;
+        depth_ = 1;
+    }
+
+    template<uint16_t KeyLen>
+    void IndexBuilder<KeyLen>::pushFrame(uint16_t level) {
+        if (depth_ == frames_.size()) {
+            frames_.emplace_back();
+        }
+        frames_[depth_].level = level;
+        frames_[depth_].children.clear();
+        depth_++;
+    }
+
+    template<uint16_t KeyLen>
+    void IndexBuilder<KeyLen>::attach(uint16_t frame, uint8_t k, N *child) {
+        if (frame == 0 && detached_) {
+            subtree_ = child;
+        } else if (frame == 0) {
+            typename ART<KeyLen>::UpperWrite upper(tree_, 0);
+            N::setChild(tree_->root_, k, child);
+        } else {
+            frames_[frame].children.emplace_back(k, child);
+        }
+    }
+
+    /* Allocates the top frame as its final node type; prefix bytes come from last_, which every key below shares */
+    template<uint16_t KeyLen>
+    N *IndexBuilder<KeyLen>::closeFrame(uint16_t prefixStart) {
+        Frame &f = frames_[--depth_];
+        auto count = f.children.size();
+        type t = count <= 4 ? NT4 : count <= 16 ? NT16 : count <= 48 ? NT48 : NT256;
+
+        N *n = tree_->art_obj_pool_->newNode(t);
+        n->setPrefix(&last_[prefixStart], f.level - prefixStart);
+        for (auto &[k, child] : f.children) {
+            N::setChild(n, k, child);
+        }
+        return n;
+    }
+
+    template<uint16_t KeyLen>
+    void IndexBuilder<KeyLen>::add(const Key &key, TID tid) {
+        if (empty_) {
+            last_ = key;
+            lastTid_ = tid;
+            empty_ = false;
+            return;
+        }
+
+        /* keys are prefix-free, so running off the shorter one means they are equal */
+        uint16_t len = std::min(last_.getKeyLen(), key.getKeyLen());
+        uint16_t d = 0;
+        while (d < len && last_[d] == key[d]) d++;
+        if (d == len) {
+            lastTid_ = tid;
+            return;
+        }
+        ASSERT(last_[d] < key[d], "bulk load input is not sorted");
+
+        /* nothing after key can share more than d bytes with last_, so its path is final now */
+        uint16_t top = depth_ - 1;
+        N *pending;
+        if (frames_[top].level > d) {
+            pending = tree_->GenNewNode(last_, frames_[top].level + 1, lastTid_);
+            while (frames_[top].level > d) {
+                attach(top, last_[frames_[top].level], pending);
+                uint16_t parentLevel = frames_[top - 1].level;
+                pending = closeFrame((parentLevel > d ? parentLevel : d) + 1);
+                top--;
+            }
+        } else {
+            pending = tree_->GenNewNode(last_, d + 1, lastTid_);
+        }
+        if (frames_[top].level < d) {
+            pushFrame(d);
+            top++;
+        }
+        attach(top, last_[d], pending);
+
+        last_ = key;
+        lastTid_ = tid;
+    }
+
+    template<uint16_t KeyLen>
+    void IndexBuilder<KeyLen>::finish() {
+        if (empty_) return;
+
+        uint16_t top = depth_ - 1;
+        N *pending = tree_->GenNewNode(last_, frames_[top].level + 1, lastTid_);
+        while (top > 0) {
+            attach(top, last_[frames_[top].level], pending);
+            pending = closeFrame(frames_[top - 1].level + 1);
+            top--;
+        }
+        attach(0, last_[frames_[0].level], pending);
+        empty_ = true;
+    }
+
+    template<uint16_t KeyLen>
+    void IndexBuilder<KeyLen>::build(const Key *keys, const TID *tids, size_t n) {
+        for (size_t i = 0; i < n; i++) {
+            add(keys[i], tids[i]);
+        }
+        finish();
+    }
+
+    template<uint16_t KeyLen>
+    void IndexBuilder<KeyLen>::buildParallel(const Key *keys, const TID *tids, size_t n) {
+        const size_t chunks = std::max<size_t>(1, std::min<size_t>(n / 4096, tbb::this_task_arena::max_concurrency() * 4));
+        const size_t chunkSize = (n + chunks - 1) / chunks;
+        std::vector<std::array<size_t, 256>> offsets(chunks);
+
+        /* histogram of the first byte per chunk */
+        tbb::parallel_for(size_t(0), chunks, [&](size_t c) {
+            auto &hist = offsets[c];
+            hist.fill(0);
+            for (size_t i = c * chunkSize; i < std::min(n, (c + 1) * chunkSize); i++) {
+                hist[keys[i][0]]++;
+            }
+        });
+
+        /* partition p of chunk c starts after all of p in earlier chunks, so the scatter stays stable */
+        size_t bounds[257];
+        size_t sum = 0;
+        for (int p = 0; p < 256; p++) {
+            bounds[p] = sum;
+            for (size_t c = 0; c < chunks; c++) {
+                size_t count = offsets[c][p];
+                offsets[c][p] = sum;
+                sum += count;
+            }
+        }
+        bounds[256] = sum;
+
+        std::vector<size_t> order(n);
+        tbb::parallel_for(size_t(0), chunks, [&](size_t c) {
+            auto &pos = offsets[c];
+            for (size_t i = c * chunkSize; i < std::min(n, (c + 1) * chunkSize); i++) {
+                order[pos[keys[i][0]]++] = i;
+            }
+        });
+
+        N *subtrees[256] = {nullptr};
+        tbb::parallel_for(0, 256, [&](int p) {
+            if (bounds[p] == bounds[p + 1]) return;
+            auto first = order.begin() + bounds[p], last = order.begin() + bounds[p + 1];
+            std::stable_sort(first, last, [&](size_t a, size_t b) { return keys[a] < keys[b]; });
+
+            IndexBuilder partition(tree_, true);
+            for (auto i = first; i != last; i++) {
+                partition.add(keys[*i], tids[*i]);
+            }
+            partition.finish();
+            subtrees[p] = partition.subtree_;
+        }, tbb::simple_partitioner());
+
+        typename ART<KeyLen>::UpperWrite upper(tree_, 0);
+        for (int p = 0; p < 256; p++) {
+            if (subtrees[p] != nullptr) {
+                N::setChild(tree_->root_, p, subtrees[p]);
+            }
+        }
+    }
+}
+
+template class Index::IndexBuilder<Index::VAR_KEY_LEN>;
+template class Index::IndexBuilder<32>;
+template class Index::IndexBuilder<64>;
+template class Index::IndexBuilder<128>;
+template class Index::IndexBuilder<256>;
@@ -1,5 +1,80 @@
 #pragma once
 
-class IndexBuilder {
-    
-};
\ No newline at end of file
+#include <cstdint>
+#include <vector>
+#include <algorithm>
+#include <array>
+
+#include "art_key.h"
+#include "art_node.h"
+#include "art_tree.h"
+#include "common/common.h"
+
+namespace Index {
+
+    /**
+     * Builds an ART bottom-up from keys that arrive in ascending order.
+     *
+     * Only the rightmost path is open: each open node collects its children until a key
+     * diverges above it, then it is allocated once with the type that fits its final
+     * child count and its prefix is written once. Nothing is published to other threads
+     * while loading, so no node is locked; the target tree must be empty and unshared
+     * until finish() returns.
+     */
+    template<uint16_t KeyLen>
+    class IndexBuilder {
+        using Key = KEY<KeyLen>;
+
+        struct Frame {
+            uint16_t level; // key byte this node branches on
+            std::vector<std::tuple<uint8_t, N*>> children;
+        };
+
+        ART<KeyLen> *tree_;
+
+        /* a partition builder hands its subtree back instead of writing the root */
+        bool detached_ = false;
+        N *subtree_ = nullptr;
+
+        /* frames_[0] is the root, deeper frames branch on strictly larger levels */
+        std::vector<Frame> frames_;
+        uint16_t depth_ = 0;
+
+        Key last_;
+        TID lastTid_ = 0;
+        bool empty_ = true;
+
+        void pushFrame(uint16_t level);
+
+        void attach(uint16_t frame, uint8_t k, N *child);
+
+        N *closeFrame(uint16_t prefixStart);
+
+        IndexBuilder(ART<KeyLen> *tree, bool detached);
+
+    public:
+        explicit IndexBuilder(ART<KeyLen> *tree);
+
+        DISALLOW_COPY_AND_MOVE(IndexBuilder)
+
+        /* keys must be ascending, a repeated key overwrites the previous TID */
+        void add(const Key &key, TID tid);
+
+        void finish();
+
+        void build(const Key *keys, const TID *tids, size_t n);
+
+        /**
+         * Loads unsorted input on all cores. Pairs are MSD-radix-partitioned on their first
+         * byte, which is exactly the root N256 slot they end up under, then every partition
+         * is sorted and bulk loaded on its own; the subtrees share no node, so they are built
+         * without any synchronization and hung under the root at the end.
+         */
+        void buildParallel(const Key *keys, const TID *tids, size_t n);
+    };
+}
+extern template class Index::IndexBuilder<Index::VAR_KEY_LEN>;
+extern template class Index::IndexBuilder<32>;
+extern template class Index::IndexBuilder<64>;
+extern template class Index::IndexBuilder<128>;
+extern template class Index::IndexBuilder<256>;
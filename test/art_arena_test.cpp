@@ -0,0 +1,139 @@
+#include <gtest/gtest.h>
+#include <random>
+#include <map>
+
+#include <index/art_key.h>
+#include <index/art_tree.h>
+#include <index/art_obj_pool.h>
+#include <index/art_arena.h>
+
+const uint16_t KEY32 = 32;
+
+using namespace Index;
+
+/**
+ * The arena itself, and children of every kind going through the slots of every node type.
+ * The slot and tree cases hold for both builds, with ART_ARENA_REFS they go through 32-bit
+ * references and leaf cells.
+ */
+class ART_ARENA_TEST : public ::testing::Test {
+protected:
+    Index::ArtObjPool pool;
+
+    std::default_random_engine gen;
+
+    /* one child of each kind: inner nodes, an inline TID, TIDs too large to inline, a KeyLeaf */
+    vector<N *> Kids() {
+        KEY<KEY32> key;
+        for (int i = 0; i < KEY32; i++) key[i] = i;
+        return {pool.newNode(NT4), pool.newNode(NT16), pool.newNode(NT48), pool.newNode(NT256),
+                (N *) N::convertToLeaf(TID(7)), (N *) N::convertToLeaf(TID(1) << 30),
+                (N *) N::convertToLeaf(TID(1) << 60), N::convertToLeaf(KeyLeaf::make(key, 9))};
+    }
+};
+
+TEST_F(ART_ARENA_TEST, ARENA_TEST)
+{
+    void *a = NodeArena::allocNode(sizeof(N256));
+    void *b = NodeArena::allocNode(sizeof(N256));
+    EXPECT_EQ(uint64_t(a) % NodeArena::LINE, 0U);
+    EXPECT_EQ(uint64_t(b) % NodeArena::LINE, 0U);
+    EXPECT_GE(std::abs(static_cast<char *>(b) - static_cast<char *>(a)), long(sizeof(N256)));
+    EXPECT_EQ(NodeArena::atLine(NodeArena::lineOf(a)), a);
+    NodeArena::freeNode(a, sizeof(N256));
+    EXPECT_EQ(NodeArena::allocNode(sizeof(N256)), a);
+    NodeArena::freeNode(a, sizeof(N256));
+    NodeArena::freeNode(b, sizeof(N256));
+
+    uint32_t c = NodeArena::newCell(~0ULL);
+    uint32_t d = NodeArena::newCell(42);
+    EXPECT_NE(c, 0U);
+    EXPECT_NE(c, d);
+    EXPECT_EQ(NodeArena::cellWord(c), ~0ULL);
+    EXPECT_EQ(NodeArena::cellWord(d), 42U);
+    NodeArena::freeCell(c);
+    EXPECT_EQ(NodeArena::newCell(1), c);
+    EXPECT_EQ(NodeArena::cellWord(c), 1U);
+    NodeArena::freeCell(c);
+    NodeArena::freeCell(d);
+}
+
+TEST_F(ART_ARENA_TEST, SLOT_TEST)
+{
+    std::cout << "slot " << sizeof(Slot) << " bytes, N4 " << sizeof(N4) << ", N16 " << sizeof(N16)
+              << ", N48 " << sizeof(N48) << ", N256 " << sizeof(N256) << endl;
+    vector<N *> kids = Kids();
+    for (auto t : {NT4, NT16, NT48, NT256}) {
+        N *n = pool.newNode(t);
+        for (size_t i = 0; i < 4; i++) {
+            N::setChild(n, i * 60, kids[i * 2 + 1]);
+        }
+        for (size_t i = 0; i < 4; i++) {
+            uint8_t k;
+            EXPECT_EQ(N::getChild(n, i * 60), kids[i * 2 + 1]);
+            EXPECT_EQ(N::getNextChild(n, i * 60, k), kids[i * 2 + 1]);
+            EXPECT_EQ(N::getPrevChild(n, i * 60, k), kids[i * 2 + 1]);
+        }
+        EXPECT_EQ(N::childType(N::findSlot(n, t, 0)), kids[1]->getType());
+
+        /* changing and removing leaves gives their cells back, so this does not grow the arena */
+        size_t reserved = 0;
+        for (int round = 0; round < 1000; round++) {
+            for (size_t i = 0; i < kids.size(); i++) {
+                N::changeChild(n, 60, kids[i]);
+                EXPECT_EQ(N::getChild(n, 60), kids[i]);
+            }
+            N::removeChild(n, 180);
+            N::setChild(n, 180, kids[round % kids.size()]);
+            if (round == 0) reserved = NodeArena::reservedBytes();
+        }
+        EXPECT_EQ(NodeArena::reservedBytes(), reserved);
+
+        std::tuple<uint8_t, N *> children[256];
+        uint16_t len = 0;
+        N::getChildren(n, 0, 255, children, len);
+        EXPECT_EQ(len, 4);
+        pool.gcNode(n);
+    }
+    KeyLeaf::release(N::getKeyLeaf(kids.back()));
+    for (int i = 0; i < 4; i++) pool.gcNode(kids[i]);
+}
+
+TEST_F(ART_ARENA_TEST, TREE_TEST)
+{
+    const size_t NUM = 1 << 16;
+    auto *tree = new ART<KEY32>(&pool);
+    std::map<KEY<KEY32>, TID> expect;
+    KEY<KEY32> key;
+    for (size_t i = 0; i < NUM; i++) {
+        uint64_t num = gen();
+        memcpy(&key[0], &num, sizeof(num));
+        memcpy(&key[0] + 8, &i, sizeof(i));
+        /* half of them inline in a reference, half in a cell */
+        TID tid = i % 2 ? i : i | TID(1) << 40;
+        tree->insert(key, tid);
+        expect[key] = tid;
+    }
+
+    size_t i = 0;
+    for (auto it = expect.begin(); it != expect.end(); i++) {
+        if (i % 3 == 0) {
+            EXPECT_EQ(tree->remove(it->first), true);
+            it = expect.erase(it);
+        } else {
+            ++it;
+        }
+    }
+
+    for (auto &[k, tid] : expect) {
+        TID res;
+        EXPECT_EQ(tree->lookup(k, res), true);
+        EXPECT_EQ(res, tid);
+    }
+    vector<TID> res;
+    tree->lookupRange(expect.begin()->first, expect.rbegin()->first, res);
+    ASSERT_EQ(res.size(), expect.size());
+    i = 0;
+    for (auto &[k, tid] : expect) EXPECT_EQ(res[i++], tid);
+    delete tree;
+}
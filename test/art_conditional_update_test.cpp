@@ -0,0 +1,116 @@
+#include <gtest/gtest.h>
+#include <random>
+#include <thread>
+
+#include <index/art_key.h>
+#include <index/art_tree.h>
+#include <index/art_obj_pool.h>
+
+const uint16_t KEY32 = 32;
+
+using namespace Index;
+
+class ART_CONDITIONAL_UPDATE_TEST : public ::testing::Test {
+protected:
+    ART<KEY32> *art_tree_32;
+
+    Index::ArtObjPool pool;
+
+    std::default_random_engine gen;
+
+    template<uint16_t KeyLen>
+    void GenRandomKey(vector<KEY<KeyLen>>& v, uint64_t count) {
+        KEY<KeyLen> r;
+        for (uint64_t i = 0; i < count; i++) {
+            uint64_t num = gen();
+            for (int j = 0; j < KeyLen/8; j++) {
+                memmove(&r[0] + 8 * j, &num, sizeof(uint64_t));
+            }
+            memmove(&r[0] + 8, &i, sizeof (uint64_t));
+
+            v.push_back(r);
+        }
+    }
+
+    void SetUp() override {
+        art_tree_32 = new ART<KEY32>(&pool);
+    }
+
+    void TearDown() override {
+        delete art_tree_32;
+    }
+};
+
+TEST_F(ART_CONDITIONAL_UPDATE_TEST, SINGLE_THREAD_TEST)
+{
+    const size_t NUM = 256*64;
+    vector<KEY<KEY32>> key_list;
+    GenRandomKey<KEY32>(key_list, NUM);
+
+    for (size_t i = 0; i < NUM; i++) {
+        EXPECT_EQ(art_tree_32->insertIfAbsent(key_list[i], i), std::nullopt);
+        EXPECT_EQ(art_tree_32->insertIfAbsent(key_list[i], i + 1), std::optional<TID>(i));
+        EXPECT_EQ(art_tree_32->compareAndSwap(key_list[i], i + 1, i + 2), false);
+    }
+
+    for (size_t i = 0; i < NUM; i++) {
+        EXPECT_EQ(art_tree_32->compareAndSwap(key_list[i], i, i * 2), true);
+        auto old = art_tree_32->upsert(key_list[i], [](std::optional<TID> t) { return *t + 1; });
+        EXPECT_EQ(old, std::optional<TID>(i * 2));
+
+        TID tid;
+        EXPECT_EQ(art_tree_32->lookup(key_list[i], tid), true);
+        EXPECT_EQ(tid, i * 2 + 1);
+    }
+
+    /* nothing is created for an absent key unless upsert asks for it */
+    EXPECT_EQ(art_tree_32->remove(key_list[0]), true);
+    EXPECT_EQ(art_tree_32->compareAndSwap(key_list[0], 1, 2), false);
+    TID tid;
+    EXPECT_EQ(art_tree_32->lookup(key_list[0], tid), false);
+    EXPECT_EQ(art_tree_32->upsert(key_list[0], [](std::optional<TID> t) { return t ? *t : 7; }), std::nullopt);
+    EXPECT_EQ(art_tree_32->lookup(key_list[0], tid), true);
+    EXPECT_EQ(tid, 7);
+}
+
+TEST_F(ART_CONDITIONAL_UPDATE_TEST, CONCURRENT_COUNTER_TEST)
+{
+    const size_t NUM = 256*4;
+    const size_t ThreadNum = 4;
+    const size_t ROUND = 50;
+    vector<KEY<KEY32>> key_list;
+    vector<std::thread*> threads;
+    GenRandomKey<KEY32>(key_list, NUM);
+
+    /* half the threads count with upsert, the other half with a compareAndSwap loop */
+    std::function<void(size_t)> count = [&](size_t id) {
+        for (size_t r = 0; r < ROUND; r++) {
+            for (size_t i = 0; i < NUM; i++) {
+                if (id % 2 == 0) {
+                    art_tree_32->upsert(key_list[i], [](std::optional<TID> t) { return t ? *t + 1 : 1; });
+                    continue;
+                }
+                while (true) {
+                    auto old = art_tree_32->insertIfAbsent(key_list[i], 1);
+                    if (!old || art_tree_32->compareAndSwap(key_list[i], *old, *old + 1)) {
+                        break;
+                    }
+                }
+            }
+        }
+    };
+
+    for (size_t i = 0; i < ThreadNum; i++) {
+        threads.emplace_back(new thread(count, i));
+    }
+    for (auto t : threads) {
+        t->join();
+        delete t;
+    }
+
+    for (size_t i = 0; i < NUM; i++) {
+        TID tid;
+        EXPECT_EQ(art_tree_32->lookup(key_list[i], tid), true);
+        EXPECT_EQ(tid, ThreadNum * ROUND);
+    }
+}
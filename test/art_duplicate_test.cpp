@@ -0,0 +1,214 @@
+#include <gtest/gtest.h>
+#include <random>
+#include <thread>
+#include <map>
+#include <set>
+
+#include <index/art_key.h>
+#include <index/art_tree.h>
+#include <index/art_obj_pool.h>
+
+const uint16_t KEY32 = 32;
+
+using namespace Index;
+
+class ART_DUPLICATE_TEST : public ::testing::Test {
+protected:
+    ART<KEY32> *art_tree_32;
+
+    Index::ArtObjPool pool;
+
+    std::default_random_engine gen;
+
+    template<uint16_t KeyLen>
+    void GenRandomKey(vector<KEY<KeyLen>>& v, uint64_t count) {
+        KEY<KeyLen> r;
+        for (uint64_t i = 0; i < count; i++) {
+            uint64_t num = gen();
+            for (int j = 0; j < KeyLen/8; j++) {
+                memmove(&r[0] + 8 * j, &num, sizeof(uint64_t));
+            }
+            memmove(&r[0] + 8, &i, sizeof (uint64_t));
+
+            v.push_back(r);
+        }
+    }
+
+    void SetUp() override {
+        art_tree_32 = new ART<KEY32>(&pool);
+    }
+
+    void TearDown() override {
+        delete art_tree_32;
+    }
+};
+
+TEST_F(ART_DUPLICATE_TEST, INSERT_DUPLICATE_TEST)
+{
+    const size_t NUM = 256*16;
+    vector<KEY<KEY32>> key_list;
+    GenRandomKey<KEY32>(key_list, NUM);
+
+    /* key i gets i % 8 + 1 TIDs, inserted in random order and each one twice */
+    std::map<KEY<KEY32>, std::set<TID>> expect;
+    vector<std::pair<size_t, TID>> ops;
+    for (size_t i = 0; i < NUM; i++) {
+        for (size_t j = 0; j <= i % 8; j++) {
+            TID tid = gen() % (1UL << 40);
+            ops.emplace_back(i, tid);
+            ops.emplace_back(i, tid);
+            expect[key_list[i]].insert(tid);
+        }
+    }
+    std::shuffle(ops.begin(), ops.end(), gen);
+    for (auto &[i, tid] : ops) {
+        art_tree_32->insertDuplicate(key_list[i], tid);
+    }
+
+    for (auto &[key, tids] : expect) {
+        vector<TID> res;
+        EXPECT_EQ(art_tree_32->lookupAll(key, res), true);
+        EXPECT_EQ(res, vector<TID>(tids.begin(), tids.end()));
+
+        TID tid;
+        EXPECT_EQ(art_tree_32->lookup(key, tid), true);
+        EXPECT_EQ(tid, *tids.begin());
+    }
+
+    /* a plain insert still replaces whatever the key held */
+    art_tree_32->insert(key_list[7], 1);
+    vector<TID> res;
+    art_tree_32->lookupAll(key_list[7], res);
+    EXPECT_EQ(res, vector<TID>{1});
+}
+
+TEST_F(ART_DUPLICATE_TEST, TID_PAIR_TEST)
+{
+    const size_t NUM = 256*16;
+    const TID BIG = 1UL << 40;
+    vector<KEY<KEY32>> key_list;
+    GenRandomKey<KEY32>(key_list, NUM);
+
+    /* two TIDs stay inline when both fit a pair, a large one or a third moves them to a list and back */
+    for (size_t i = 0; i < NUM; i++) {
+        TID a = i, b = i % 2 ? BIG + i : NUM + i, c = 2 * NUM + i;
+        art_tree_32->insertDuplicate(key_list[i], b);
+        art_tree_32->insertDuplicate(key_list[i], a);
+        vector<TID> res;
+        art_tree_32->lookupAll(key_list[i], res);
+        EXPECT_EQ(res, (vector<TID>{a, b}));
+
+        art_tree_32->insertDuplicate(key_list[i], c);
+        res.clear();
+        art_tree_32->lookupAll(key_list[i], res);
+        EXPECT_EQ(res, i % 2 ? (vector<TID>{a, c, b}) : (vector<TID>{a, b, c}));
+
+        EXPECT_EQ(art_tree_32->removeTid(key_list[i], b), true);
+        res.clear();
+        art_tree_32->lookupAll(key_list[i], res);
+        EXPECT_EQ(res, (vector<TID>{a, c}));
+
+        EXPECT_EQ(art_tree_32->removeTid(key_list[i], b), false);
+        EXPECT_EQ(art_tree_32->removeTid(key_list[i], a), true);
+        TID tid;
+        EXPECT_EQ(art_tree_32->lookup(key_list[i], tid), true);
+        EXPECT_EQ(tid, c);
+    }
+}
+
+TEST_F(ART_DUPLICATE_TEST, REMOVE_TID_TEST)
+{
+    const size_t NUM = 256*16;
+    const TID DUP = 5;
+    vector<KEY<KEY32>> key_list;
+    GenRandomKey<KEY32>(key_list, NUM);
+    for (size_t i = 0; i < NUM; i++) {
+        for (TID t = 0; t < DUP; t++) {
+            art_tree_32->insertDuplicate(key_list[i], i * DUP + t);
+        }
+    }
+
+    for (size_t i = 0; i < NUM; i++) {
+        EXPECT_EQ(art_tree_32->removeTid(key_list[i], NUM * DUP), false);
+        for (TID t = 0; t < DUP; t++) {
+            vector<TID> res;
+            EXPECT_EQ(art_tree_32->lookupAll(key_list[i], res), true);
+            EXPECT_EQ(res.size(), DUP - t);
+            EXPECT_EQ(res.front(), i * DUP + t);
+
+            EXPECT_EQ(art_tree_32->removeTid(key_list[i], i * DUP + t), true);
+            EXPECT_EQ(art_tree_32->removeTid(key_list[i], i * DUP + t), false);
+        }
+        /* the last TID took the key with it */
+        TID tid;
+        EXPECT_EQ(art_tree_32->lookup(key_list[i], tid), false);
+    }
+}
+
+TEST_F(ART_DUPLICATE_TEST, SCAN_TEST)
+{
+    const size_t NUM = 256*16;
+    const TID DUP = 3;
+    vector<KEY<KEY32>> key_list;
+    GenRandomKey<KEY32>(key_list, NUM);
+
+    std::map<KEY<KEY32>, size_t> sorted;
+    for (size_t i = 0; i < NUM; i++) {
+        for (TID t = DUP; t > 0; t--) {
+            art_tree_32->insertDuplicate(key_list[i], i * DUP + t);
+        }
+        sorted[key_list[i]] = i;
+    }
+
+    vector<TID> res, expect;
+    art_tree_32->lookupRange(KEY<KEY32>(), sorted.rbegin()->first, res);
+    for (auto &[key, i] : sorted) {
+        for (TID t = 1; t <= DUP; t++) {
+            expect.push_back(i * DUP + t);
+        }
+    }
+    EXPECT_EQ(res, expect);
+}
+
+TEST_F(ART_DUPLICATE_TEST, CONCURRENT_DUPLICATE_TEST)
+{
+    const size_t NUM = 256*4;
+    const size_t ThreadNum = 4;
+    const TID DUP = 16;
+    vector<KEY<KEY32>> key_list;
+    vector<std::thread*> threads;
+    GenRandomKey<KEY32>(key_list, NUM);
+
+    /* all threads pile TIDs onto the same keys, and take half of their own back */
+    std::function<void(size_t)> insert = [&](size_t id) {
+        for (TID t = 0; t < DUP; t++) {
+            for (size_t i = 0; i < NUM; i++) {
+                art_tree_32->insertDuplicate(key_list[i], (t * ThreadNum + id) * NUM + i);
+            }
+        }
+        for (TID t = 0; t < DUP; t += 2) {
+            for (size_t i = 0; i < NUM; i++) {
+                EXPECT_EQ(art_tree_32->removeTid(key_list[i], (t * ThreadNum + id) * NUM + i), true);
+            }
+        }
+    };
+
+    for (size_t i = 0; i < ThreadNum; i++) {
+        threads.emplace_back(new thread(insert, i));
+    }
+    for (auto t : threads) {
+        t->join();
+        delete t;
+    }
+
+    for (size_t i = 0; i < NUM; i++) {
+        vector<TID> res, expect;
+        art_tree_32->lookupAll(key_list[i], res);
+        for (TID t = 1; t < DUP; t += 2) {
+            for (size_t id = 0; id < ThreadNum; id++) {
+                expect.push_back((t * ThreadNum + id) * NUM + i);
+            }
+        }
+        EXPECT_EQ(res, expect);
+    }
+}
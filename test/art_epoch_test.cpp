@@ -0,0 +1,200 @@
+#include <gtest/gtest.h>
+#include <random>
+#include <thread>
+#include <chrono>
+
+#include <index/art_key.h>
+#include <index/art_tree.h>
+#include <index/art_obj_pool.h>
+
+const uint16_t KEY32 = 32;
+
+using namespace Index;
+
+/**
+ * Retired nodes going back to the pool, with the background reclaimer doing it for the threads
+ * that retire them, or on the quiescent points the threads announce, also when the threads that
+ * retired them have exited.
+ */
+class ART_EPOCH_TEST : public ::testing::Test {
+protected:
+    Index::ArtObjPool pool;
+
+    std::default_random_engine gen;
+
+    vector<KEY<KEY32>> Keys(size_t num) {
+        vector<KEY<KEY32>> keys(num);
+        for (size_t i = 0; i < num; i++) {
+            uint64_t n = gen();
+            memcpy(&keys[i][0], &n, sizeof(n));
+            memcpy(&keys[i][0] + 8, &i, sizeof(i));
+        }
+        return keys;
+    }
+
+    size_t LiveNodes() {
+        size_t live = 0;
+        for (auto t : {NT4, NT16, NT48, NT256}) live += pool.stats(t).liveNodes;
+        return live;
+    }
+};
+
+TEST_F(ART_EPOCH_TEST, BACKGROUND_TEST)
+{
+    const size_t NUM = 1 << 16;
+    auto *tree = new ART<KEY32>(&pool);
+    tree->reclaimInBackground();
+    auto keys = Keys(NUM);
+    for (size_t i = 0; i < NUM; i++) tree->insert(keys[i], i);
+    size_t full = LiveNodes();
+    for (size_t i = 0; i < NUM; i++) EXPECT_EQ(tree->remove(keys[i]), true);
+
+    /* what this thread retired is handed over in batches, the last one may stay with it */
+    auto start = std::chrono::steady_clock::now();
+    while (LiveNodes() > 1000 && std::chrono::steady_clock::now() - start < std::chrono::seconds(10)) {
+        std::this_thread::sleep_for(std::chrono::milliseconds(1));
+    }
+    EXPECT_LE(LiveNodes(), 1000U);
+    std::cout << full << " nodes in use with all keys, " << LiveNodes() << " after removing them" << endl;
+    delete tree;
+}
+
+TEST_F(ART_EPOCH_TEST, CONCURRENT_TEST)
+{
+    const size_t NUM = 1 << 16;
+    const int THREADS = 4;
+    auto *tree = new ART<KEY32>(&pool);
+    tree->reclaimInBackground();
+    auto keys = Keys(NUM);
+    for (size_t i = 0; i < NUM; i += 2) tree->insert(keys[i], i);
+
+    /* odd keys come and go while the even ones must stay readable */
+    std::atomic<uint64_t> errors{0};
+    std::vector<std::thread> threads;
+    for (int id = 0; id < THREADS; id++) {
+        threads.emplace_back([&, id] {
+            for (int round = 0; round < 4; round++) {
+                for (size_t i = 1 + 2 * id; i < NUM; i += 2 * THREADS) {
+                    tree->insert(keys[i], i);
+                    TID tid;
+                    if (!tree->lookup(keys[i - 1], tid) || tid != i - 1) errors++;
+                }
+                for (size_t i = 1 + 2 * id; i < NUM; i += 2 * THREADS) {
+                    if (!tree->remove(keys[i])) errors++;
+                }
+            }
+        });
+    }
+    for (auto &t : threads) t.join();
+
+    EXPECT_EQ(errors.load(), 0U);
+    for (size_t i = 0; i < NUM; i++) {
+        TID tid;
+        EXPECT_EQ(tree->lookup(keys[i], tid), i % 2 == 0);
+    }
+    delete tree;
+}
+
+TEST_F(ART_EPOCH_TEST, SLOT_TEST)
+{
+    /* more threads than one block of slots, each reclaiming on its own */
+    const size_t NUM = 1 << 16;
+    const int THREADS = 100;
+    auto *tree = new ART<KEY32>(&pool);
+    auto keys = Keys(NUM);
+
+    std::atomic<uint64_t> errors{0};
+    std::vector<std::thread> threads;
+    for (int id = 0; id < THREADS; id++) {
+        threads.emplace_back([&, id] {
+            for (int round = 0; round < 4; round++) {
+                for (size_t i = id; i < NUM; i += THREADS) tree->insert(keys[i], i);
+                for (size_t i = id; i < NUM; i += THREADS) {
+                    TID tid;
+                    if (!tree->lookup(keys[i], tid) || tid != i) errors++;
+                    if (!tree->remove(keys[i])) errors++;
+                }
+            }
+        });
+    }
+    for (auto &t : threads) t.join();
+    EXPECT_EQ(errors.load(), 0U);
+    size_t left = LiveNodes();
+
+    /* what the threads left retired went to the epoch as they exited, the next collection here frees it */
+    for (size_t i = 0; i < NUM / 16; i++) tree->insert(keys[i], i);
+    for (size_t i = 0; i < NUM / 16; i++) EXPECT_EQ(tree->remove(keys[i]), true);
+    EXPECT_LE(LiveNodes(), 1000U);
+    std::cout << left << " nodes retired when the threads exited, " << LiveNodes() << " after collecting" << endl;
+    delete tree;
+}
+
+TEST_F(ART_EPOCH_TEST, QSBR_TEST)
+{
+    const size_t NUM = 1 << 16;
+    const int THREADS = 4;
+    auto *tree = new ART<KEY32>(&pool);
+    tree->reclaimOnQuiescence();
+    auto keys = Keys(NUM);
+    for (size_t i = 0; i < NUM; i += 2) tree->insert(keys[i], i);
+
+    /* a reader that stays online holds back every node retired after it came online */
+    std::atomic<int> step{0};
+    std::thread reader([&] {
+        TID tid;
+        EXPECT_EQ(tree->lookup(keys[0], tid), true);
+        step = 1;
+        while (step != 2) std::this_thread::yield();
+        tree->offline();
+    });
+    while (step != 1) std::this_thread::yield();
+    size_t full = LiveNodes();
+    for (size_t i = 0; i < NUM; i += 2) {
+        EXPECT_EQ(tree->remove(keys[i]), true);
+        if (i % 128 == 0) tree->quiescent();
+    }
+    EXPECT_GE(LiveNodes(), full - 1000);
+    step = 2;
+    reader.join();
+
+    /* with the reader gone, this thread frees it all at its next quiescent points */
+    for (size_t i = 0; i < NUM; i += 2) tree->insert(keys[i], i);
+    for (size_t i = 0; i < NUM; i += 2) {
+        EXPECT_EQ(tree->remove(keys[i]), true);
+        if (i % 128 == 0) tree->quiescent();
+    }
+    tree->quiescent();
+    EXPECT_LE(LiveNodes(), 1000U);
+    std::cout << full << " nodes in use with the even keys, " << LiveNodes() << " after removing them" << endl;
+
+    /* writers announce once per batch, the odd keys come and go while the even ones stay */
+    for (size_t i = 0; i < NUM; i += 2) tree->insert(keys[i], i);
+    tree->offline(); /* only waits for them */
+    std::atomic<uint64_t> errors{0};
+    std::vector<std::thread> threads;
+    for (int id = 0; id < THREADS; id++) {
+        threads.emplace_back([&, id] {
+            for (int round = 0; round < 4; round++) {
+                size_t n = 0;
+                for (size_t i = 1 + 2 * id; i < NUM; i += 2 * THREADS) {
+                    tree->insert(keys[i], i);
+                    TID tid;
+                    if (!tree->lookup(keys[i - 1], tid) || tid != i - 1) errors++;
+                    if (++n % 64 == 0) tree->quiescent();
+                }
+                for (size_t i = 1 + 2 * id; i < NUM; i += 2 * THREADS) {
+                    if (!tree->remove(keys[i])) errors++;
+                    if (++n % 64 == 0) tree->quiescent();
+                }
+            }
+            tree->offline();
+        });
+    }
+    for (auto &t : threads) t.join();
+    EXPECT_EQ(errors.load(), 0U);
+    for (size_t i = 0; i < NUM; i++) {
+        TID tid;
+        EXPECT_EQ(tree->lookup(keys[i], tid), i % 2 == 0);
+    }
+    delete tree;
+}
@@ -0,0 +1,169 @@
+#include <gtest/gtest.h>
+#include <random>
+#include <map>
+
+#include <index/art_key.h>
+#include <index/art_tree.h>
+#include <index/art_obj_pool.h>
+#include <index/index_builder.h>
+
+const uint16_t KEY32 = 32;
+const uint16_t KEY128 = 128;
+
+using namespace Index;
+
+class ART_INDEX_BUILDER_TEST : public ::testing::Test {
+protected:
+    ART<KEY32> *art_tree_32;
+    ART<KEY128> *art_tree_128;
+
+    Index::ArtObjPool pool;
+
+    std::default_random_engine gen;
+
+    template<uint16_t KeyLen>
+    void GenOrderedKey(vector<KEY<KeyLen>>& v, int count) {
+        KEY<KeyLen> r;
+        int idx = KeyLen - 1;
+        for (int i = 0; i < count; i++) {
+            v.push_back(r);
+
+            if (r[idx] == UINT8_MAX) {
+                while (r[idx] == UINT8_MAX) {
+                    r[idx--] = 0;
+                    r[idx] += 1;
+                }
+            } else {
+                r[idx] += 1;
+            }
+            idx = KeyLen - 1;
+        }
+    }
+
+    template<uint16_t KeyLen>
+    void GenRandomKey(vector<KEY<KeyLen>>& v, uint64_t count) {
+        KEY<KeyLen> r;
+        for (uint64_t i = 0; i < count; i++) {
+            uint64_t num = gen();
+            for (int j = 0; j < KeyLen/8; j++) {
+                memmove(&r[0] + 8 * j, &num, sizeof(uint64_t));
+            }
+            memmove(&r[0] + 8, &i, sizeof (uint64_t));
+
+            v.push_back(r);
+        }
+    }
+
+    void SetUp() override {
+        art_tree_32 = new ART<KEY32>(&pool);
+        art_tree_128 = new ART<KEY128>(&pool);
+    }
+
+    void TearDown() override {
+        delete art_tree_32;
+        delete art_tree_128;
+    }
+};
+
+TEST_F(ART_INDEX_BUILDER_TEST, ORDER_BUILD_TEST)
+{
+    const int NUM = 256*256*4;
+    vector<KEY<KEY32>> key_list;
+    GenOrderedKey<KEY32>(key_list, NUM);
+    vector<TID> tids(NUM);
+    for (int i = 0; i < NUM; i++) tids[i] = i;
+
+    auto now1 = std::chrono::steady_clock::now();
+    IndexBuilder<KEY32> builder(art_tree_32);
+    builder.build(key_list.data(), tids.data(), NUM);
+    auto end1 = std::chrono::steady_clock::now();
+
+    for (int i = 0; i < NUM; i++) {
+        TID tid;
+        EXPECT_EQ(art_tree_32->lookup(key_list[i], tid), true);
+        EXPECT_EQ(tid, i);
+    }
+
+    /* the loaded tree is an ordinary tree afterwards */
+    ART<KEY32> inserted(&pool);
+    auto now2 = std::chrono::steady_clock::now();
+    for (int i = 0; i < NUM; i++) {
+        inserted.insert(key_list[i], i);
+    }
+    auto end2 = std::chrono::steady_clock::now();
+    for (int i = 0; i < NUM; i += 2) {
+        EXPECT_EQ(art_tree_32->remove(key_list[i]), true);
+    }
+    TID tid;
+    EXPECT_EQ(art_tree_32->lookup(key_list[0], tid), false);
+    EXPECT_EQ(art_tree_32->lookup(key_list[1], tid), true);
+
+    std::cout << "Build: " << std::chrono::duration<double>(end1 - now1).count() << endl;
+    std::cout << "Insert: " << std::chrono::duration<double>(end2 - now2).count() << endl;
+}
+
+TEST_F(ART_INDEX_BUILDER_TEST, RANDOM_BUILD_TEST)
+{
+    const size_t NUM = 256*256;
+    vector<KEY<KEY128>> key_list;
+    GenRandomKey<KEY128>(key_list, NUM);
+
+    std::map<KEY<KEY128>, TID> sorted;
+    for (size_t i = 0; i < NUM; i++) {
+        sorted[key_list[i]] = i;
+    }
+
+    IndexBuilder<KEY128> builder(art_tree_128);
+    for (auto &[k, tid] : sorted) {
+        builder.add(k, tid);
+    }
+    builder.finish();
+
+    ART<KEY128>::Iterator it(art_tree_128);
+    auto expect = sorted.begin();
+    for (it.seek(KEY<KEY128>()); it.valid(); it.next(), expect++) {
+        ASSERT_NE(expect, sorted.end());
+        EXPECT_EQ(it.key(), expect->first);
+        EXPECT_EQ(it.tid(), expect->second);
+    }
+    EXPECT_EQ(expect, sorted.end());
+
+    for (size_t i = 0; i < NUM; i++) {
+        TID tid;
+        EXPECT_EQ(art_tree_128->lookup(key_list[i], tid), true);
+        EXPECT_EQ(tid, i);
+    }
+}
+
+TEST_F(ART_INDEX_BUILDER_TEST, PARALLEL_BUILD_TEST)
+{
+    const size_t NUM = 256*256*8;
+    vector<KEY<KEY32>> key_list;
+    GenRandomKey<KEY32>(key_list, NUM);
+    vector<TID> tids(NUM);
+    for (size_t i = 0; i < NUM; i++) tids[i] = i;
+
+    /* a repeated key keeps the TID that comes last in the input */
+    key_list.push_back(key_list[7]);
+    tids.push_back(NUM);
+
+    auto now1 = std::chrono::steady_clock::now();
+    IndexBuilder<KEY32> builder(art_tree_32);
+    builder.buildParallel(key_list.data(), tids.data(), key_list.size());
+    auto end1 = std::chrono::steady_clock::now();
+
+    for (size_t i = 0; i < NUM; i++) {
+        TID tid;
+        EXPECT_EQ(art_tree_32->lookup(key_list[i], tid), true);
+        EXPECT_EQ(tid, i == 7 ? NUM : i);
+    }
+
+    size_t count = 0;
+    ART<KEY32>::Iterator it(art_tree_32);
+    for (it.seek(KEY<KEY32>()); it.valid(); it.next()) {
+        count++;
+    }
+    EXPECT_EQ(count, NUM);
+
+    std::cout << "Parallel Build: " << std::chrono::duration<double>(end1 - now1).count() << endl;
+}
@@ -0,0 +1,189 @@
+#include <gtest/gtest.h>
+#include <random>
+#include <thread>
+#include <set>
+#include <map>
+
+#include <index/art_key.h>
+#include <index/art_tree.h>
+#include <index/art_obj_pool.h>
+
+const uint16_t KEY32 = 32;
+
+using namespace Index;
+
+class ART_ITERATOR_TEST : public ::testing::Test {
+protected:
+    ART<KEY32> *art_tree_32;
+
+    Index::ArtObjPool pool;
+
+    std::default_random_engine gen;
+
+    template<uint16_t KeyLen>
+    void GenRandomKey(vector<KEY<KeyLen>>& v, uint64_t count) {
+        KEY<KeyLen> r;
+        for (uint64_t i = 0; i < count; i++) {
+            uint64_t num = gen();
+            for (int j = 0; j < KeyLen/8; j++) {
+                memmove(&r[0] + 8 * j, &num, sizeof(uint64_t));
+            }
+            memmove(&r[0] + 8, &i, sizeof (uint64_t));
+
+            v.push_back(r);
+        }
+    }
+
+    void SetUp() override {
+        art_tree_32 = new ART<KEY32>(&pool);
+    }
+
+    void TearDown() override {
+        delete art_tree_32;
+    }
+};
+
+TEST_F(ART_ITERATOR_TEST, SCAN_TEST)
+{
+    const size_t NUM = 256*256;
+    vector<KEY<KEY32>> key_list;
+    GenRandomKey<KEY32>(key_list, NUM);
+
+    std::map<KEY<KEY32>, TID> sorted;
+    for (size_t i = 0; i < NUM; i++) {
+        art_tree_32->insert(key_list[i], i);
+        sorted[key_list[i]] = i;
+    }
+
+    ART<KEY32>::Iterator it(art_tree_32);
+    auto expect = sorted.begin();
+    for (it.seek(KEY<KEY32>()); it.valid(); it.next(), expect++) {
+        ASSERT_NE(expect, sorted.end());
+        EXPECT_EQ(it.key(), expect->first);
+        EXPECT_EQ(it.tid(), expect->second);
+    }
+    EXPECT_EQ(expect, sorted.end());
+
+    /* walk back from the largest key */
+    KEY<KEY32> max;
+    memset(&max[0], 0xFF, KEY32);
+    auto rexpect = sorted.rbegin();
+    for (it.seekForPrev(max); it.valid(); it.prev(), rexpect++) {
+        ASSERT_NE(rexpect, sorted.rend());
+        EXPECT_EQ(it.key(), rexpect->first);
+    }
+    EXPECT_EQ(rexpect, sorted.rend());
+}
+
+TEST_F(ART_ITERATOR_TEST, SEEK_TEST)
+{
+    const size_t NUM = 256*16;
+    vector<KEY<KEY32>> key_list;
+    GenRandomKey<KEY32>(key_list, NUM * 2);
+
+    std::map<KEY<KEY32>, TID> sorted;
+    for (size_t i = 0; i < NUM; i++) {
+        art_tree_32->insert(key_list[i], i);
+        sorted[key_list[i]] = i;
+    }
+
+    ART<KEY32>::Iterator it(art_tree_32);
+    for (size_t i = 0; i < NUM * 2; i++) {
+        /* present keys hit exactly, absent keys land on their neighbours */
+        it.seek(key_list[i]);
+        auto lower = sorted.lower_bound(key_list[i]);
+        EXPECT_EQ(it.valid(), lower != sorted.end());
+        if (it.valid()) {
+            EXPECT_EQ(it.key(), lower->first);
+            it.prev();
+            if (lower == sorted.begin()) {
+                EXPECT_EQ(it.valid(), false);
+            } else {
+                EXPECT_EQ(it.key(), std::prev(lower)->first);
+            }
+        }
+
+        it.seekForPrev(key_list[i]);
+        auto upper = sorted.upper_bound(key_list[i]);
+        EXPECT_EQ(it.valid(), upper != sorted.begin());
+        if (it.valid()) {
+            EXPECT_EQ(it.key(), std::prev(upper)->first);
+        }
+    }
+}
+
+TEST_F(ART_ITERATOR_TEST, RANGE_TEST)
+{
+    const size_t NUM = 256*256;
+    vector<KEY<KEY32>> key_list;
+    GenRandomKey<KEY32>(key_list, NUM);
+
+    std::map<KEY<KEY32>, TID> sorted;
+    for (size_t i = 0; i < NUM; i++) {
+        art_tree_32->insert(key_list[i], i);
+        sorted[key_list[i]] = i;
+    }
+
+    for (size_t i = 0; i + 1 < 100; i += 2) {
+        KEY<KEY32> k1 = key_list[i], k2 = key_list[i + 1];
+        if (k2 < k1) std::swap(k1, k2);
+
+        vector<TID> res;
+        art_tree_32->lookupRange(k1, k2, res);
+
+        vector<TID> expect;
+        for (auto it = sorted.lower_bound(k1); it != sorted.upper_bound(k2); it++) {
+            expect.push_back(it->second);
+        }
+        EXPECT_EQ(res, expect);
+    }
+
+    /* the result tells whether this call found anything, not whether res was empty */
+    vector<TID> res{0};
+    auto last = std::prev(sorted.end())->first, first = sorted.begin()->first;
+    EXPECT_EQ(art_tree_32->lookupRange(last, first, res), false);
+    EXPECT_EQ(art_tree_32->lookupRange(first, first, res), true);
+    EXPECT_EQ(res, (vector<TID>{0, sorted.begin()->second}));
+}
+
+TEST_F(ART_ITERATOR_TEST, CONCURRENT_SCAN_TEST)
+{
+    const size_t NUM = 256*256;
+    vector<KEY<KEY32>> key_list;
+    GenRandomKey<KEY32>(key_list, NUM * 2);
+
+    std::set<KEY<KEY32>> stable;
+    for (size_t i = 0; i < NUM; i++) {
+        art_tree_32->insert(key_list[i], i);
+        stable.insert(key_list[i]);
+    }
+
+    std::atomic<bool> done{false};
+    std::thread writer([&]() {
+        for (size_t i = NUM; i < NUM * 2; i++) {
+            art_tree_32->insert(key_list[i], i);
+        }
+        for (size_t i = NUM; i < NUM * 2; i++) {
+            art_tree_32->remove(key_list[i]);
+        }
+        done = true;
+    });
+
+    /* every scan sees keys in order and never misses one that is not touched by the writer */
+    do {
+        ART<KEY32>::Iterator it(art_tree_32);
+        size_t seen = 0;
+        KEY<KEY32> last;
+        bool first = true;
+        for (it.seek(KEY<KEY32>()); it.valid(); it.next()) {
+            if (!first) {
+                EXPECT_LT(last, it.key());
+            }
+            first = false;
+            last = it.key();
+            seen += stable.count(it.key());
+        }
+        EXPECT_EQ(seen, NUM);
+    } while (!done);
+    writer.join();
+}
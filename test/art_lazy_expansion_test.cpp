@@ -0,0 +1,181 @@
+#include <gtest/gtest.h>
+#include <random>
+#include <thread>
+#include <map>
+
+#include <index/art_key.h>
+#include <index/art_tree.h>
+#include <index/art_obj_pool.h>
+
+const uint16_t KEY256 = 256;
+
+using namespace Index;
+
+class ART_LAZY_EXPANSION_TEST : public ::testing::Test {
+protected:
+    ART<KEY256> *art_tree_256;
+
+    Index::ArtObjPool pool;
+
+    std::default_random_engine gen;
+
+    template<uint16_t KeyLen>
+    void GenRandomKey(vector<KEY<KeyLen>>& v, uint64_t count) {
+        KEY<KeyLen> r;
+        for (uint64_t i = 0; i < count; i++) {
+            uint64_t num = gen();
+            for (int j = 0; j < KeyLen/8; j++) {
+                memmove(&r[0] + 8 * j, &num, sizeof(uint64_t));
+            }
+            memmove(&r[0] + 8, &i, sizeof (uint64_t));
+
+            v.push_back(r);
+        }
+    }
+
+    /* keys equal to a common base except for one byte, so every pair shares a long run of bytes */
+    template<uint16_t KeyLen>
+    void GenSharedPrefixKey(vector<KEY<KeyLen>>& v, uint64_t count) {
+        KEY<KeyLen> base;
+        memset(&base[0], 0x5A, KeyLen);
+        for (uint64_t i = 0; i < count; i++) {
+            KEY<KeyLen> r = base;
+            r[gen() % KeyLen] = gen() % 256;
+            v.push_back(r);
+        }
+    }
+
+    void SetUp() override {
+        art_tree_256 = new ART<KEY256>(&pool);
+    }
+
+    void TearDown() override {
+        delete art_tree_256;
+    }
+};
+
+TEST_F(ART_LAZY_EXPANSION_TEST, LONG_KEY_TEST)
+{
+    const size_t NUM = 256*64;
+    vector<KEY<KEY256>> key_list;
+    GenRandomKey<KEY256>(key_list, NUM);
+    for (size_t i = 0; i < NUM; i++) {
+        art_tree_256->insert(key_list[i], i);
+    }
+
+    for (size_t i = 0; i < NUM; i++) {
+        TID tid;
+        EXPECT_EQ(art_tree_256->lookup(key_list[i], tid), true);
+        EXPECT_EQ(tid, i);
+
+        /* only the tail differs, the search ends on the same leaf and has to compare the stored key */
+        KEY<KEY256> other = key_list[i];
+        other[KEY256 - 1] ^= 1;
+        EXPECT_EQ(art_tree_256->lookup(other, tid), false);
+        EXPECT_EQ(art_tree_256->remove(other), false);
+    }
+
+    for (size_t i = 0; i < NUM; i += 2) {
+        EXPECT_EQ(art_tree_256->remove(key_list[i]), true);
+    }
+    for (size_t i = 0; i < NUM; i++) {
+        TID tid;
+        EXPECT_EQ(art_tree_256->lookup(key_list[i], tid), i % 2 == 1);
+    }
+}
+
+TEST_F(ART_LAZY_EXPANSION_TEST, SPLIT_TEST)
+{
+    const size_t NUM = 256*16;
+    vector<KEY<KEY256>> key_list;
+    GenSharedPrefixKey<KEY256>(key_list, NUM * 2);
+
+    std::map<KEY<KEY256>, TID> sorted;
+    for (size_t i = 0; i < NUM; i++) {
+        art_tree_256->insert(key_list[i], i);
+        sorted[key_list[i]] = i;
+    }
+
+    for (size_t i = 0; i < NUM * 2; i++) {
+        TID tid;
+        auto it = sorted.find(key_list[i]);
+        EXPECT_EQ(art_tree_256->lookup(key_list[i], tid), it != sorted.end());
+        if (it != sorted.end()) {
+            EXPECT_EQ(tid, it->second);
+        }
+    }
+
+    /* seeks through lazily expanded leaves still land on the neighbours */
+    ART<KEY256>::Iterator it(art_tree_256);
+    for (size_t i = 0; i < NUM * 2; i++) {
+        it.seek(key_list[i]);
+        auto lower = sorted.lower_bound(key_list[i]);
+        EXPECT_EQ(it.valid(), lower != sorted.end());
+        if (it.valid()) {
+            EXPECT_EQ(it.key(), lower->first);
+            EXPECT_EQ(it.tid(), lower->second);
+        }
+
+        it.seekForPrev(key_list[i]);
+        auto upper = sorted.upper_bound(key_list[i]);
+        EXPECT_EQ(it.valid(), upper != sorted.begin());
+        if (it.valid()) {
+            EXPECT_EQ(it.key(), std::prev(upper)->first);
+        }
+    }
+
+    /* removing collapses the splits again, and the tree keeps working afterwards */
+    for (auto &[key, tid] : sorted) {
+        EXPECT_EQ(art_tree_256->remove(key), true);
+    }
+    for (size_t i = 0; i < NUM; i++) {
+        TID tid;
+        EXPECT_EQ(art_tree_256->lookup(key_list[i], tid), false);
+    }
+    for (size_t i = 0; i < NUM; i++) {
+        art_tree_256->insert(key_list[i], i + 1);
+    }
+    auto expect = sorted.begin();
+    for (it.seek(KEY<KEY256>()); it.valid(); it.next(), expect++) {
+        ASSERT_NE(expect, sorted.end());
+        EXPECT_EQ(it.key(), expect->first);
+    }
+    EXPECT_EQ(expect, sorted.end());
+}
+
+TEST_F(ART_LAZY_EXPANSION_TEST, CONCURRENT_SPLIT_TEST)
+{
+    const size_t NUM = 256*64;
+    const size_t ThreadNum = 4;
+    const size_t CountPerThread = NUM / ThreadNum;
+    vector<KEY<KEY256>> key_list;
+    vector<std::thread*> threads;
+
+    GenSharedPrefixKey<KEY256>(key_list, NUM);
+    std::map<KEY<KEY256>, size_t> first;
+    for (size_t i = 0; i < NUM; i++) {
+        first.emplace(key_list[i], i);
+    }
+
+    std::function<void(size_t, size_t)> insert = [&](size_t i, size_t j) {
+        for (size_t k = i; k < j; k++) {
+            if (first[key_list[k]] == k) {
+                art_tree_256->insert(key_list[k], k);
+            }
+        }
+    };
+
+    for (size_t i = 0; i < ThreadNum; i++) {
+        threads.emplace_back(new thread(insert, i * CountPerThread, (i + 1) * CountPerThread));
+    }
+    for (auto t : threads) {
+        t->join();
+        delete t;
+    }
+
+    for (auto &[key, i] : first) {
+        TID tid;
+        EXPECT_EQ(art_tree_256->lookup(key, tid), true);
+        EXPECT_EQ(tid, i);
+    }
+}
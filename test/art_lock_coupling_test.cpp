@@ -0,0 +1,166 @@
+#include <gtest/gtest.h>
+#include <random>
+#include <thread>
+#include <chrono>
+#include <map>
+
+#include <index/art_key.h>
+#include <index/art_tree_lock.h>
+#include <index/art_obj_pool.h>
+
+const uint16_t KEY32 = 32;
+
+using namespace Index;
+
+/**
+ * ART_Lock coupling per-node latches: range scans agree with an ordered map, and writers on
+ * several threads neither lose keys nor keep readers and scans from seeing the keys already in.
+ */
+class ART_LOCK_COUPLING_TEST : public ::testing::Test {
+protected:
+    Index::ArtObjPool pool;
+
+    std::default_random_engine gen;
+
+    /* keys sort like i, a few high bytes vary so nodes of every size and prefixes show up */
+    static KEY<KEY32> Key(uint64_t i) {
+        KEY<KEY32> key;
+        memset(&key[0], 0, KEY32);
+        uint64_t hi = __builtin_bswap64(i);
+        memcpy(&key[0] + 2, &hi, sizeof(hi));
+        return key;
+    }
+};
+
+TEST_F(ART_LOCK_COUPLING_TEST, RANGE_TEST)
+{
+    const size_t NUM = 1 << 16;
+    auto *tree = new ART_Lock<KEY32>(&pool);
+    std::map<uint64_t, TID> expect;
+    for (size_t i = 0; i < NUM; i++) {
+        uint64_t n = gen() % (NUM * 16);
+        tree->insert(Key(n), i);
+        expect[n] = i;
+    }
+
+    for (int round = 0; round < 200; round++) {
+        uint64_t a = gen() % (NUM * 16), b = a + gen() % (round % 2 ? 64 : 1 << 16);
+        vector<TID> res, want;
+        for (auto it = expect.lower_bound(a); it != expect.end() && it->first <= b; ++it) {
+            want.push_back(it->second);
+        }
+        EXPECT_EQ(tree->lookupRange(Key(a), Key(b), res), !want.empty());
+        EXPECT_EQ(res, want);
+    }
+
+    /* both ends are inclusive, an inverted range is empty */
+    auto first = expect.begin();
+    vector<TID> res;
+    EXPECT_EQ(tree->lookupRange(Key(first->first), Key(first->first), res), true);
+    EXPECT_EQ(res, vector<TID>{first->second});
+    res.clear();
+    EXPECT_EQ(tree->lookupRange(Key(NUM * 16), Key(0), res), false);
+    delete tree;
+}
+
+TEST_F(ART_LOCK_COUPLING_TEST, CONCURRENT_TEST)
+{
+    const size_t NUM = 1 << 17;
+    const int THREADS = 4;
+    vector<uint64_t> nums(NUM);
+    for (auto &n : nums) n = gen() % (NUM * 64) * 2;
+
+    /* single-threaded inserts first, then the same number split over threads, for the scaling */
+    for (int threadNum : {1, THREADS}) {
+        auto *tree = new ART_Lock<KEY32>(&pool);
+        for (size_t i = 0; i < NUM; i += 2) tree->insert(Key(nums[i] + 1), i);
+
+        std::atomic<bool> stop{false};
+        std::atomic<uint64_t> errors{0};
+        std::thread reader([&] {
+            std::default_random_engine rgen;
+            while (!stop) {
+                size_t i = rgen() % (NUM / 2) * 2;
+                TID tid;
+                if (!tree->lookup(Key(nums[i] + 1), tid)) errors++;
+                vector<TID> res;
+                if (!tree->lookupRange(Key(nums[i]), Key(nums[i] + 1), res)) errors++;
+            }
+        });
+
+        auto start = std::chrono::steady_clock::now();
+        std::vector<std::thread> writers;
+        for (int id = 0; id < threadNum; id++) {
+            writers.emplace_back([&, id] {
+                for (size_t i = id; i < NUM; i += threadNum) tree->insert(Key(nums[i]), i);
+            });
+        }
+        for (auto &t : writers) t.join();
+        auto end = std::chrono::steady_clock::now();
+        stop = true;
+        reader.join();
+
+        EXPECT_EQ(errors.load(), 0U);
+        std::map<uint64_t, TID> last;
+        for (size_t i = 0; i < NUM; i++) last[nums[i]] = i;
+        for (auto [n, i] : last) {
+            TID tid;
+            ASSERT_EQ(tree->lookup(Key(n), tid), true);
+            if (threadNum == 1) {
+                EXPECT_EQ(tid, i);
+            }
+        }
+        std::cout << threadNum << " writer threads: " << NUM << " inserts in "
+                  << std::chrono::duration_cast<std::chrono::milliseconds>(end - start).count() << " ms" << endl;
+        delete tree;
+    }
+}
+
+TEST_F(ART_LOCK_COUPLING_TEST, CONCURRENT_SCAN_TEST)
+{
+    const size_t NUM = 1 << 16;
+    const int THREADS = 2;
+
+    /* TIDs are the keys, the even ones are in before the scans start and must all be seen */
+    auto *tree = new ART_Lock<KEY32>(&pool);
+    for (size_t i = 0; i < NUM; i += 2) tree->insert(Key(i), i);
+
+    std::atomic<int> running{THREADS};
+    std::atomic<uint64_t> errors{0}, scans{0};
+    std::thread scanner([&] {
+        std::default_random_engine rgen;
+        do {
+            uint64_t a = rgen() % NUM, b = a + rgen() % 4096;
+            vector<TID> res;
+            tree->lookupRange(Key(a), Key(b), res);
+            uint64_t even = (a + 1) / 2 * 2;
+            for (size_t j = 0; j < res.size(); j++) {
+                if (res[j] < a || res[j] > b || (j > 0 && res[j] <= res[j - 1])) errors++;
+                if (res[j] % 2 == 0) {
+                    if (res[j] != even) errors++;
+                    even = res[j] + 2;
+                }
+            }
+            if (even <= std::min<uint64_t>(b, NUM - 2)) errors++;
+            scans++;
+        } while (running > 0);
+    });
+
+    std::vector<std::thread> writers;
+    for (int id = 0; id < THREADS; id++) {
+        writers.emplace_back([&, id] {
+            for (size_t i = 2 * id + 1; i < NUM; i += 2 * THREADS) tree->insert(Key(i), i);
+            running--;
+        });
+    }
+    for (auto &t : writers) t.join();
+    scanner.join();
+
+    EXPECT_EQ(errors.load(), 0U);
+    EXPECT_GT(scans.load(), 0U);
+    vector<TID> res, want(NUM);
+    for (size_t i = 0; i < NUM; i++) want[i] = i;
+    EXPECT_EQ(tree->lookupRange(Key(0), Key(NUM - 1), res), true);
+    EXPECT_EQ(res, want);
+    delete tree;
+}
@@ -0,0 +1,164 @@
+#include <gtest/gtest.h>
+#include <random>
+#include <thread>
+#include <map>
+
+#include <index/art_key.h>
+#include <index/art_tree.h>
+#include <index/art_obj_pool.h>
+#include <index/index_builder.h>
+
+const uint16_t KEY128 = 128;
+
+using namespace Index;
+
+class ART_LONG_PREFIX_TEST : public ::testing::Test {
+protected:
+    ART<KEY128> *art_tree_128;
+
+    Index::ArtObjPool pool;
+
+    std::default_random_engine gen;
+
+    /**
+     * Keys made of a tenant id and a short random tail. Tenant ids share their first
+     * 40 bytes and are 100 bytes long, so nodes carry prefixes far beyond MAX_PREFIX_LEN
+     * and inserts split them in the middle.
+     */
+    template<uint16_t KeyLen>
+    void GenTenantKey(vector<KEY<KeyLen>>& v, uint64_t count, int tenants) {
+        vector<KEY<KeyLen>> ids(tenants);
+        for (auto &id : ids) {
+            memset(&id[0], 0x33, 40);
+            for (int j = 40; j < 100; j++) {
+                id[j] = gen() % 4;
+            }
+        }
+        for (uint64_t i = 0; i < count; i++) {
+            KEY<KeyLen> r = ids[gen() % tenants];
+            for (int j = 100; j < KeyLen; j++) {
+                r[j] = gen() % 256;
+            }
+            v.push_back(r);
+        }
+    }
+
+    void SetUp() override {
+        art_tree_128 = new ART<KEY128>(&pool);
+    }
+
+    void TearDown() override {
+        delete art_tree_128;
+    }
+};
+
+TEST_F(ART_LONG_PREFIX_TEST, INSERT_REMOVE_TEST)
+{
+    const size_t NUM = 256*64;
+    vector<KEY<KEY128>> key_list;
+    GenTenantKey<KEY128>(key_list, NUM * 2, 8);
+
+    std::map<KEY<KEY128>, TID> sorted;
+    for (size_t i = 0; i < NUM; i++) {
+        art_tree_128->insert(key_list[i], i);
+        sorted[key_list[i]] = i;
+    }
+
+    for (size_t i = 0; i < NUM * 2; i++) {
+        TID tid;
+        auto it = sorted.find(key_list[i]);
+        EXPECT_EQ(art_tree_128->lookup(key_list[i], tid), it != sorted.end());
+        if (it != sorted.end()) {
+            EXPECT_EQ(tid, it->second);
+        }
+
+        /* a byte inside the shared prefix differs, the descent has to fail in the long prefix */
+        KEY<KEY128> other = key_list[i];
+        other[70] = 0xFF;
+        EXPECT_EQ(art_tree_128->lookup(other, tid), false);
+    }
+
+    ART<KEY128>::Iterator it(art_tree_128);
+    auto expect = sorted.begin();
+    for (it.seek(KEY<KEY128>()); it.valid(); it.next(), expect++) {
+        ASSERT_NE(expect, sorted.end());
+        EXPECT_EQ(it.key(), expect->first);
+        EXPECT_EQ(it.tid(), expect->second);
+    }
+    EXPECT_EQ(expect, sorted.end());
+
+    /* removing whole tenants merges their parents into ever longer prefixes */
+    for (auto &[key, tid] : sorted) {
+        if (key[60] != 0) {
+            EXPECT_EQ(art_tree_128->remove(key), true);
+        }
+    }
+    for (auto &[key, tid] : sorted) {
+        TID found;
+        EXPECT_EQ(art_tree_128->lookup(key, found), key[60] == 0);
+    }
+}
+
+TEST_F(ART_LONG_PREFIX_TEST, BULK_LOAD_TEST)
+{
+    const size_t NUM = 256*64;
+    vector<KEY<KEY128>> key_list;
+    GenTenantKey<KEY128>(key_list, NUM, 4);
+    std::sort(key_list.begin(), key_list.end());
+    key_list.erase(std::unique(key_list.begin(), key_list.end()), key_list.end());
+
+    vector<TID> tids(key_list.size());
+    for (size_t i = 0; i < tids.size(); i++) tids[i] = i;
+    IndexBuilder<KEY128> builder(art_tree_128);
+    builder.build(key_list.data(), tids.data(), key_list.size());
+
+    for (size_t i = 0; i < key_list.size(); i++) {
+        TID tid;
+        EXPECT_EQ(art_tree_128->lookup(key_list[i], tid), true);
+        EXPECT_EQ(tid, i);
+    }
+}
+
+TEST_F(ART_LONG_PREFIX_TEST, CONCURRENT_SPLIT_TEST)
+{
+    const size_t NUM = 256*64;
+    const size_t ThreadNum = 4;
+    const size_t CountPerThread = NUM / ThreadNum;
+    vector<KEY<KEY128>> key_list;
+    vector<std::thread*> threads;
+
+    /* the first half is loaded up front, the second half splits its long prefixes under readers */
+    GenTenantKey<KEY128>(key_list, NUM, 2);
+    vector<KEY<KEY128>> more;
+    GenTenantKey<KEY128>(more, NUM, 64);
+    for (size_t i = 0; i < NUM; i++) {
+        art_tree_128->insert(key_list[i], i);
+    }
+
+    std::function<void(size_t, size_t)> insert = [&](size_t i, size_t j) {
+        for (size_t k = i; k < j; k++) {
+            art_tree_128->insert(more[k], NUM + k);
+        }
+        for (size_t k = i; k < j; k++) {
+            art_tree_128->remove(more[k]);
+        }
+    };
+
+    std::function<void(size_t, size_t)> lookup = [&](size_t i, size_t j) {
+        for (int round = 0; round < 3; round++) {
+            for (size_t k = i; k < j; k++) {
+                TID tid;
+                EXPECT_EQ(art_tree_128->lookup(key_list[k], tid), true);
+            }
+        }
+    };
+
+    for (size_t i = 0; i < ThreadNum; i++) {
+        threads.emplace_back(new thread(insert, i * CountPerThread, (i + 1) * CountPerThread));
+        threads.emplace_back(new thread(lookup, i * CountPerThread, (i + 1) * CountPerThread));
+    }
+    for (auto t : threads) {
+        t->join();
+        delete t;
+    }
+}
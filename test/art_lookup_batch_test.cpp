@@ -0,0 +1,112 @@
+#include <gtest/gtest.h>
+#include <random>
+#include <thread>
+
+#include <index/art_key.h>
+#include <index/art_tree.h>
+#include <index/art_obj_pool.h>
+
+const uint16_t KEY32 = 32;
+
+using namespace Index;
+
+class ART_LOOKUP_BATCH_TEST : public ::testing::Test {
+protected:
+    ART<KEY32> *art_tree_32;
+
+    Index::ArtObjPool pool;
+
+    std::default_random_engine gen;
+
+    template<uint16_t KeyLen>
+    void GenRandomKey(vector<KEY<KeyLen>>& v, uint64_t count) {
+        KEY<KeyLen> r;
+        for (uint64_t i = 0; i < count; i++) {
+            uint64_t num = gen();
+            for (int j = 0; j < KeyLen/8; j++) {
+                memmove(&r[0] + 8 * j, &num, sizeof(uint64_t));
+            }
+            memmove(&r[0] + 8, &i, sizeof (uint64_t));
+
+            v.push_back(r);
+        }
+    }
+
+    void SetUp() override {
+        art_tree_32 = new ART<KEY32>(&pool);
+    }
+
+    void TearDown() override {
+        delete art_tree_32;
+    }
+};
+
+TEST_F(ART_LOOKUP_BATCH_TEST, BATCH_LOOKUP_TEST)
+{
+    const size_t NUM = 256*256*16;
+    const size_t BATCH = 128;
+    vector<KEY<KEY32>> key_list;
+    GenRandomKey<KEY32>(key_list, NUM + NUM / 4);
+
+    for (size_t i = 0; i < NUM; i++) {
+        art_tree_32->insert(key_list[i], i);
+    }
+
+    /* the tail of key_list was never inserted */
+    vector<TID> out(key_list.size());
+    std::unique_ptr<bool[]> found(new bool[key_list.size()]);
+
+    auto now1 = std::chrono::steady_clock::now();
+    for (size_t i = 0; i < key_list.size(); i += BATCH) {
+        size_t n = std::min(BATCH, key_list.size() - i);
+        art_tree_32->lookupBatch(&key_list[i], n, &out[i], &found[i]);
+    }
+    auto end1 = std::chrono::steady_clock::now();
+
+    for (size_t i = 0; i < key_list.size(); i++) {
+        EXPECT_EQ(found[i], i < NUM);
+        if (i < NUM) {
+            EXPECT_EQ(out[i], i);
+        }
+    }
+
+    auto now2 = std::chrono::steady_clock::now();
+    for (size_t i = 0; i < key_list.size(); i++) {
+        art_tree_32->lookup(key_list[i], out[i]);
+    }
+    auto end2 = std::chrono::steady_clock::now();
+
+    std::cout << "Batch Avg: " << std::chrono::duration_cast<chrono::nanoseconds>(end1 - now1).count() / key_list.size() << endl;
+    std::cout << "Single Avg: " << std::chrono::duration_cast<chrono::nanoseconds>(end2 - now2).count() / key_list.size() << endl;
+}
+
+TEST_F(ART_LOOKUP_BATCH_TEST, CONCURRENT_BATCH_LOOKUP_TEST)
+{
+    const size_t NUM = 256*256*4;
+    const size_t BATCH = 64;
+    vector<KEY<KEY32>> key_list;
+    GenRandomKey<KEY32>(key_list, NUM * 2);
+
+    for (size_t i = 0; i < NUM; i++) {
+        art_tree_32->insert(key_list[i], i);
+    }
+
+    std::thread writer([&]() {
+        for (size_t i = NUM; i < NUM * 2; i++) {
+            art_tree_32->insert(key_list[i], i);
+        }
+    });
+
+    vector<TID> out(NUM);
+    std::unique_ptr<bool[]> found(new bool[NUM]);
+    for (int round = 0; round < 4; round++) {
+        for (size_t i = 0; i < NUM; i += BATCH) {
+            art_tree_32->lookupBatch(&key_list[i], BATCH, &out[i], &found[i]);
+        }
+        for (size_t i = 0; i < NUM; i++) {
+            EXPECT_EQ(found[i], true);
+            EXPECT_EQ(out[i], i);
+        }
+    }
+    writer.join();
+}
@@ -0,0 +1,148 @@
+#include <gtest/gtest.h>
+#include <random>
+#include <chrono>
+
+#include <index/art_node.h>
+#include <index/art_obj_pool.h>
+
+using namespace Index;
+
+/**
+ * Node level microbenchmark: child lookups through the out-of-line N::getChild, which
+ * switches on the type behind a call into the library, against N::findChild, where the
+ * switch is hoisted by N::visit and the per-type lookup is inlined. Numbers only mean
+ * something in a -DCMAKE_BUILD_TYPE=Release build.
+ */
+class ART_NODE_DISPATCH_TEST : public ::testing::Test {
+protected:
+    Index::ArtObjPool pool;
+
+    std::default_random_engine gen;
+
+    vector<N *> nodes;
+
+    /* count children with random key bytes, leaves stand in for the children */
+    N *GenNode(type t, int count) {
+        N *n = pool.newNode(t);
+        vector<uint8_t> bytes(256);
+        for (int i = 0; i < 256; i++) bytes[i] = i;
+        std::shuffle(bytes.begin(), bytes.end(), gen);
+        for (int i = 0; i < count; i++) {
+            N::setChild(n, bytes[i], (N *) N::convertToLeaf(bytes[i] + 1));
+        }
+        nodes.push_back(n);
+        return n;
+    }
+
+    template<typename Probe>
+    uint64_t Run(const vector<N *> &probe_nodes, const vector<uint8_t> &keys, Probe &&probe, double &ns) {
+        uint64_t sum = 0;
+        auto now = std::chrono::steady_clock::now();
+        for (size_t i = 0; i < keys.size(); i++) {
+            N *child = probe(probe_nodes[i % probe_nodes.size()], keys[i]);
+            sum += child ? N::getLeaf(child) : 0;
+        }
+        auto end = std::chrono::steady_clock::now();
+        ns = double(std::chrono::duration_cast<chrono::nanoseconds>(end - now).count()) / keys.size();
+        return sum;
+    }
+
+    void Compare(const char *name, const vector<N *> &probe_nodes) {
+        const size_t PROBES = 1 << 22;
+        vector<uint8_t> keys(PROBES);
+        for (auto &k : keys) k = gen();
+
+        double switch_ns, visit_ns;
+        uint64_t a = Run(probe_nodes, keys, [](const N *n, uint8_t k) { return N::getChild(n, k); }, switch_ns);
+        uint64_t b = Run(probe_nodes, keys, [](const N *n, uint8_t k) { return N::findChild(n, k); }, visit_ns);
+        EXPECT_EQ(a, b);
+        std::cout << name << " switch: " << switch_ns << " ns, visit: " << visit_ns << " ns" << endl;
+    }
+
+    void TearDown() override {
+        for (auto n : nodes) {
+            pool.gcNode(n);
+        }
+    }
+};
+
+TEST_F(ART_NODE_DISPATCH_TEST, PER_TYPE_TEST)
+{
+    Compare("N4  ", {GenNode(NT4, 4)});
+    Compare("N16 ", {GenNode(NT16, 16)});
+    Compare("N48 ", {GenNode(NT48, 48)});
+    Compare("N256", {GenNode(NT256, 200)});
+}
+
+TEST_F(ART_NODE_DISPATCH_TEST, MIXED_TYPE_TEST)
+{
+    /* consecutive probes hit different node types, like a descent does level by level */
+    vector<N *> mixed;
+    for (int i = 0; i < 1024; i++) {
+        switch (gen() % 4) {
+            case 0: mixed.push_back(GenNode(NT4, 1 + gen() % 4)); break;
+            case 1: mixed.push_back(GenNode(NT16, 5 + gen() % 12)); break;
+            case 2: mixed.push_back(GenNode(NT48, 17 + gen() % 32)); break;
+            default: mixed.push_back(GenNode(NT256, 49 + gen() % 200)); break;
+        }
+    }
+    Compare("mixed", mixed);
+}
+
+TEST_F(ART_NODE_DISPATCH_TEST, ALIGNMENT_TEST)
+{
+    /* fresh and recycled nodes of every type start on a cache line */
+    for (int round = 0; round < 2; round++) {
+        vector<N *> fresh;
+        for (auto t : {NT4, NT16, NT48, NT256}) {
+            for (int i = 0; i < 16; i++) {
+                N *n = pool.newNode(t);
+                EXPECT_EQ(uint64_t(n) % CACHE_LINE_SIZE, 0);
+                fresh.push_back(n);
+            }
+        }
+        for (auto n : fresh) {
+            pool.gcNode(n);
+        }
+    }
+}
+
+TEST_F(ART_NODE_DISPATCH_TEST, CHILD_TAG_TEST)
+{
+    /* inner children of every type and both kinds of leaves come back out exactly as they went in */
+    vector<N *> kids = {pool.newNode(NT4), pool.newNode(NT16), pool.newNode(NT48), pool.newNode(NT256),
+                        (N *) N::convertToLeaf(TID(7)), (N *) N::convertToLeaf(TID(3))};
+    for (int i = 0; i < 4; i++) nodes.push_back(kids[i]);
+
+    for (auto t : {NT4, NT16, NT48, NT256}) {
+        for (size_t count : {size_t(1), size_t(4)}) {
+            N *n = GenNode(t, 0);
+            for (size_t i = 0; i < count; i++) {
+                N::setChild(n, i * 50, kids[(i + count) % kids.size()]);
+            }
+            uint8_t prefix[1] = {0};
+            N *copy = N::copyWithPrefix(n, prefix, 0, &pool);
+            nodes.push_back(copy);
+
+            std::tuple<uint8_t, N *> children[256];
+            uint16_t len = 0;
+            N::getChildren(copy, 0, 255, children, len);
+            ASSERT_EQ(len, count);
+            for (size_t i = 0; i < count; i++) {
+                N *kid = kids[(i + count) % kids.size()];
+                uint8_t k;
+                EXPECT_EQ(N::getChild(n, i * 50), kid);
+                EXPECT_EQ(N::untagChild(N::findSlot(n, t, i * 50)), kid);
+                if (!N::isLeaf(kid)) {
+                    EXPECT_EQ(N::childType(N::findSlot(n, t, i * 50)), kid->getType());
+                }
+                EXPECT_EQ(N::getNextChild(n, i * 50, k), kid);
+                EXPECT_EQ(N::getPrevChild(n, i * 50, k), kid);
+                EXPECT_EQ(std::get<1>(children[i]), kid);
+            }
+            N::changeChild(copy, 0, kids[0]);
+            EXPECT_EQ(N::untagChild(N::findSlot(copy, copy->getType(), 0)), kids[0]);
+            EXPECT_EQ(N::childType(N::findSlot(copy, copy->getType(), 0)), NT4);
+        }
+    }
+}
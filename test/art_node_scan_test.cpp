@@ -0,0 +1,142 @@
+#include <gtest/gtest.h>
+#include <random>
+#include <chrono>
+
+#include <index/art_node.h>
+#include <index/art_obj_pool.h>
+
+using namespace Index;
+
+/**
+ * Checks every SlotScan the CPU supports against a plain loop, over arrays from empty to full,
+ * and prints how long a full enumeration of a N48 and a N256 takes with each of them.
+ */
+class ART_NODE_SCAN_TEST : public ::testing::Test {
+protected:
+    std::default_random_engine gen;
+
+    const uint8_t EMPTY = 48;
+
+    uint8_t keys[256];
+
+    N *slots[256];
+
+    uint32_t refs[256];
+
+    /* each slot is used with probability used / 256 */
+    void Fill(int used) {
+        for (int i = 0; i < 256; i++) {
+            bool set = int(gen() % 256) < used;
+            keys[i] = set ? gen() % 48 : EMPTY;
+            slots[i] = set ? (N *) N::convertToLeaf(i + 1) : nullptr;
+            refs[i] = set ? i + 1 : 0;
+        }
+    }
+
+    vector<ScanIsa> Supported() {
+        vector<ScanIsa> res;
+        for (auto isa : {ScanIsa::SSE2, ScanIsa::AVX2, ScanIsa::AVX512}) {
+            if (slotScanSupported(isa)) res.push_back(isa);
+        }
+        return res;
+    }
+};
+
+TEST_F(ART_NODE_SCAN_TEST, KERNEL_TEST)
+{
+    for (auto isa : Supported()) {
+        const SlotScan &scan = slotScan(isa);
+        for (int used : {0, 1, 4, 48, 128, 255, 256}) {
+            for (int round = 0; round < 16; round++) {
+                Fill(used);
+                for (int i = -1; i <= 256; i++) {
+                    if (i >= 0) {
+                        int expect = i;
+                        while (expect < 256 && keys[expect] == EMPTY) expect++;
+                        EXPECT_EQ(scan.nextByte(keys, EMPTY, i), expect) << scan.isa << " " << i;
+
+                        expect = i;
+                        while (expect < 256 && slots[expect] == nullptr) expect++;
+                        EXPECT_EQ(scan.nextPtr(slots, i), expect) << scan.isa << " " << i;
+                        EXPECT_EQ(scan.nextRef(refs, i), expect) << scan.isa << " " << i;
+                    }
+                    if (i <= 255) {
+                        int expect = i;
+                        while (expect >= 0 && keys[expect] == EMPTY) expect--;
+                        EXPECT_EQ(scan.prevByte(keys, EMPTY, i), expect) << scan.isa << " " << i;
+
+                        expect = i;
+                        while (expect >= 0 && slots[expect] == nullptr) expect--;
+                        EXPECT_EQ(scan.prevPtr(slots, i), expect) << scan.isa << " " << i;
+                        EXPECT_EQ(scan.prevRef(refs, i), expect) << scan.isa << " " << i;
+                    }
+                }
+            }
+        }
+    }
+}
+
+TEST_F(ART_NODE_SCAN_TEST, NODE_TEST)
+{
+    /* the node level walks, forward and backward, agree with getChild over every key */
+    Index::ArtObjPool pool;
+    for (auto t : {NT48, NT256}) {
+        for (int count : {1, 17, 48}) {
+            N *n = pool.newNode(t);
+            vector<uint8_t> bytes(256);
+            for (int i = 0; i < 256; i++) bytes[i] = i;
+            std::shuffle(bytes.begin(), bytes.end(), gen);
+            for (int i = 0; i < count; i++) {
+                N::setChild(n, bytes[i], (N *) N::convertToLeaf(bytes[i] + 1));
+            }
+
+            vector<uint8_t> expect;
+            for (int k = 0; k < 256; k++) {
+                if (N::getChild(n, k)) expect.push_back(k);
+            }
+
+            std::tuple<uint8_t, N *> children[256];
+            uint16_t len = 0;
+            N::getChildren(n, 0, 255, children, len);
+            ASSERT_EQ(len, expect.size());
+            for (uint16_t i = 0; i < len; i++) {
+                EXPECT_EQ(std::get<0>(children[i]), expect[i]);
+                EXPECT_EQ(N::getLeaf(std::get<1>(children[i])), expect[i] + 1U);
+            }
+
+            uint8_t k;
+            vector<uint8_t> prev;
+            for (N *c = N::getPrevChild(n, 255, k); c != nullptr; c = N::getPrevChild(n, k - 1, k)) {
+                prev.push_back(k);
+                if (k == 0) break;
+            }
+            EXPECT_EQ(vector<uint8_t>(prev.rbegin(), prev.rend()), expect);
+            pool.gcNode(n);
+        }
+    }
+}
+
+TEST_F(ART_NODE_SCAN_TEST, SPEED_TEST)
+{
+    const int ROUND = 1 << 16;
+    Fill(24);
+    for (auto isa : Supported()) {
+        const SlotScan &scan = slotScan(isa);
+        uint64_t sum = 0;
+        auto now = std::chrono::steady_clock::now();
+        for (int r = 0; r < ROUND; r++) {
+            for (uint16_t i = scan.nextByte(keys, EMPTY, 0); i < 256; i = scan.nextByte(keys, EMPTY, i + 1)) sum += i;
+        }
+        auto mid = std::chrono::steady_clock::now();
+        for (int r = 0; r < ROUND; r++) {
+            for (uint16_t i = scan.nextPtr(slots, 0); i < 256; i = scan.nextPtr(slots, i + 1)) sum += i;
+        }
+        auto end = std::chrono::steady_clock::now();
+        std::cout << scan.isa << " N48 walk: "
+                  << double(std::chrono::duration_cast<chrono::nanoseconds>(mid - now).count()) / ROUND
+                  << (&scan == N48_SCAN ? " ns (selected)" : " ns") << ", N256 walk: "
+                  << double(std::chrono::duration_cast<chrono::nanoseconds>(end - mid).count()) / ROUND
+                  << (&scan == N256_SCAN ? " ns (selected)" : " ns") << endl;
+        EXPECT_NE(sum, 0);
+    }
+}
@@ -0,0 +1,152 @@
+#include <gtest/gtest.h>
+#include <random>
+#include <thread>
+#include <fstream>
+
+#include <index/art_key.h>
+#include <index/art_tree.h>
+#include <index/art_obj_pool.h>
+
+const uint16_t KEY32 = 32;
+
+using namespace Index;
+
+/**
+ * NUMA placement of pool nodes, and lookups through the per-node replicas of the upper levels
+ * while writers change those levels. On a machine with one node only the single-node path runs.
+ */
+class ART_NUMA_TEST : public ::testing::Test {
+protected:
+    Index::ArtObjPool pool;
+
+    /* byte 0 and 2 pick one of 16 subtrees and a branch in it, the rest is the same for all */
+    static KEY<KEY32> Key(uint8_t a, uint8_t b, uint64_t rest) {
+        KEY<KEY32> key;
+        memset(&key[0], 0, KEY32);
+        key[0] = a;
+        key[1] = 7;
+        key[2] = b;
+        memcpy(&key[0] + 3, &rest, sizeof(rest));
+        return key;
+    }
+};
+
+TEST_F(ART_NUMA_TEST, POOL_TEST)
+{
+    std::ifstream online("/sys/devices/system/node/online");
+    std::string list;
+    int nodes = online >> list ? std::atoi(list.c_str() + (list.find_last_of(",-") + 1)) + 1 : 1;
+    EXPECT_EQ(ArtObjPool::numaNodes(), nodes);
+    EXPECT_LT(ArtObjPool::currentNumaNode(), std::min(nodes, int(ArtObjPool::MAX_NUMA_NODES)));
+
+    /* threads on any node take and give back through the free lists of their own node */
+    Index::ArtObjPool slabPool(NodeSource::SLAB);
+    std::vector<std::thread> threads;
+    for (int id = 0; id < 4; id++) {
+        threads.emplace_back([&] {
+            for (int round = 0; round < 100; round++) {
+                std::vector<N *> taken;
+                for (int i = 0; i < 100; i++) taken.push_back(slabPool.newNode(static_cast<type>(i % 4)));
+                for (N *n : taken) slabPool.gcNode(n);
+            }
+        });
+    }
+    for (auto &t : threads) t.join();
+    std::cout << nodes << " NUMA nodes, " << slabPool.slabCount() << " slabs" << endl;
+}
+
+TEST_F(ART_NUMA_TEST, REPLICA_TEST)
+{
+    auto *tree = new ART<KEY32>(&pool);
+    tree->replicateUpperLevels(2);
+    for (int a = 0; a < 16; a++) {
+        for (int b = 0; b < 10; b++) {
+            for (uint64_t r = 0; r < 3; r++) tree->insert(Key(a, b, r), a << 16 | b << 8 | r);
+        }
+    }
+
+    TID tid;
+    ASSERT_EQ(tree->lookup(Key(3, 4, 2), tid), true);
+    EXPECT_EQ(tid, 3U << 16 | 4 << 8 | 2);
+    EXPECT_EQ(tree->replicaBuilds(), 1U);
+
+    /* below the replicated levels nothing goes stale */
+    tree->insert(Key(3, 4, 100), 1);
+    tree->remove(Key(5, 6, 1));
+    EXPECT_EQ(tree->lookup(Key(3, 4, 100), tid), true);
+    EXPECT_EQ(tree->lookup(Key(5, 6, 1), tid), false);
+    EXPECT_EQ(tree->replicaBuilds(), 1U);
+
+    /* a new first byte changes the root, the next lookup makes a new replica */
+    tree->insert(Key(200, 0, 0), 2);
+    EXPECT_EQ(tree->lookup(Key(200, 0, 0), tid), true);
+    EXPECT_EQ(tid, 2U);
+    EXPECT_EQ(tree->replicaBuilds(), 2U);
+
+    std::vector<KEY<KEY32>> keys;
+    for (int a = 0; a < 16; a++) {
+        for (int b = 0; b < 10; b++) keys.push_back(Key(a, b, 2));
+    }
+    std::vector<TID> out(keys.size());
+    std::unique_ptr<bool[]> found(new bool[keys.size()]);
+    tree->lookupBatch(keys.data(), keys.size(), out.data(), found.get());
+    for (size_t i = 0; i < keys.size(); i++) {
+        EXPECT_EQ(found[i], true);
+        EXPECT_EQ(out[i], i / 10 << 16 | i % 10 << 8 | 2);
+    }
+    delete tree;
+}
+
+TEST_F(ART_NUMA_TEST, CONCURRENT_TEST)
+{
+    const size_t NUM = 1 << 16;
+    auto *tree = new ART<KEY32>(&pool);
+    tree->replicateUpperLevels(2);
+    std::default_random_engine gen;
+    vector<KEY<KEY32>> keys(NUM);
+    for (size_t i = 0; i < NUM; i++) {
+        keys[i] = Key(gen() % 64, gen() % 256, i);
+        tree->insert(keys[i], i);
+    }
+
+    /* writers keep changing the first two levels, also right above the keys read, which must all still be found */
+    std::atomic<bool> stop{false};
+    std::atomic<uint64_t> errors{0};
+    std::vector<std::thread> threads;
+    for (int id = 0; id < 2; id++) {
+        threads.emplace_back([&, id] {
+            std::default_random_engine wgen(id);
+            for (uint64_t i = 0; !stop; i++) {
+                auto key = Key(wgen() % 256, wgen() % 256, NUM + i);
+                tree->insert(key, i);
+                if (i % 2) tree->remove(key);
+            }
+        });
+    }
+    for (int id = 0; id < 2; id++) {
+        threads.emplace_back([&, id] {
+            std::default_random_engine rgen(id);
+            std::vector<TID> out(64);
+            std::unique_ptr<bool[]> found(new bool[64]);
+            for (int round = 0; round < 2000; round++) {
+                size_t first = rgen() % (NUM - 64);
+                for (size_t i = first; i < first + 64; i++) {
+                    TID tid;
+                    if (!tree->lookup(keys[i], tid) || tid != i) errors++;
+                }
+                tree->lookupBatch(keys.data() + first, 64, out.data(), found.get());
+                for (size_t i = 0; i < 64; i++) {
+                    if (!found[i] || out[i] != first + i) errors++;
+                }
+            }
+        });
+    }
+    for (size_t t = 2; t < threads.size(); t++) threads[t].join();
+    stop = true;
+    threads[0].join();
+    threads[1].join();
+
+    EXPECT_EQ(errors.load(), 0U);
+    std::cout << tree->replicaBuilds() << " replicas made" << endl;
+    delete tree;
+}
@@ -0,0 +1,276 @@
+#include <gtest/gtest.h>
+#include <random>
+#include <thread>
+#include <mutex>
+#include <chrono>
+#include <set>
+
+#include <index/art_key.h>
+#include <index/art_tree.h>
+#include <index/art_node.h>
+#include <index/art_obj_pool.h>
+
+const uint16_t KEY32 = 32;
+
+using namespace Index;
+
+/**
+ * Nodes handed out by the pool are never handed out twice while in use, however they travel
+ * between the threads' magazines and the depot, and trees work the same on slab backed pools.
+ */
+class ART_OBJ_POOL_TEST : public ::testing::Test {
+protected:
+    Index::ArtObjPool pool;
+
+    /* the prefix of a node in use names its owner, a node handed out twice loses it */
+    static void Stamp(N *n, uint64_t id) {
+        n->setPrefix(reinterpret_cast<const uint8_t *>(&id), sizeof(id));
+    }
+
+    static bool HasStamp(const N *n, uint64_t id) {
+        return n->getPrefixLen() == sizeof(id) && memcmp(n->getPrefix(), &id, sizeof(id)) == 0;
+    }
+};
+
+TEST_F(ART_OBJ_POOL_TEST, REUSE_TEST)
+{
+    /* a thread gets back what it freed, beyond what fits its magazine too; fresh nodes come 32 at a time */
+    for (auto t : {NT4, NT16, NT48, NT256}) {
+        std::set<N *> freed;
+        for (int i = 0; i < 192; i++) {
+            N *n = pool.newNode(t);
+            EXPECT_EQ(n->getType(), t);
+            freed.insert(n);
+        }
+        for (N *n : freed) pool.gcNode(n);
+        for (int i = 0; i < 192; i++) {
+            N *n = pool.newNode(t);
+            EXPECT_EQ(freed.count(n), 1U);
+            EXPECT_EQ(n->getCount(), 0);
+            EXPECT_EQ(n->getPrefixLen(), 0);
+        }
+    }
+}
+
+TEST_F(ART_OBJ_POOL_TEST, CONCURRENT_TEST)
+{
+    const int THREADS = 8;
+    const int ROUND = 20000;
+
+    /* every thread frees half of what it takes into the next thread's hands, so nodes cross magazines */
+    std::vector<std::vector<N *>> handoff(THREADS);
+    std::vector<std::mutex> locks(THREADS);
+    std::atomic<uint64_t> errors{0};
+
+    auto now = std::chrono::steady_clock::now();
+    std::vector<std::thread> threads;
+    for (int id = 0; id < THREADS; id++) {
+        threads.emplace_back([&, id] {
+            std::default_random_engine gen(id);
+            std::vector<std::pair<N *, uint64_t>> mine;
+            for (int r = 0; r < ROUND; r++) {
+                uint64_t stamp = uint64_t(id) << 32 | r;
+                N *n = pool.newNode(static_cast<type>(gen() % 4));
+                Stamp(n, stamp);
+                mine.emplace_back(n, stamp);
+                if (mine.size() < 64) continue;
+
+                std::shuffle(mine.begin(), mine.end(), gen);
+                for (size_t i = 0; i < mine.size(); i++) {
+                    if (!HasStamp(mine[i].first, mine[i].second)) errors++;
+                    if (i % 2) {
+                        pool.gcNode(mine[i].first);
+                    } else {
+                        std::lock_guard<std::mutex> g(locks[(id + 1) % THREADS]);
+                        handoff[(id + 1) % THREADS].push_back(mine[i].first);
+                    }
+                }
+                mine.clear();
+
+                std::vector<N *> theirs;
+                {
+                    std::lock_guard<std::mutex> g(locks[id]);
+                    theirs.swap(handoff[id]);
+                }
+                for (N *m : theirs) pool.gcNode(m);
+            }
+            for (auto &[m, stamp] : mine) pool.gcNode(m);
+        });
+    }
+    for (auto &t : threads) t.join();
+    auto end = std::chrono::steady_clock::now();
+    for (auto &nodes : handoff) {
+        for (N *n : nodes) pool.gcNode(n);
+    }
+
+    EXPECT_EQ(errors.load(), 0U);
+    std::cout << THREADS * ROUND << " nodes taken and freed in "
+              << std::chrono::duration_cast<std::chrono::milliseconds>(end - now).count() << " ms" << endl;
+}
+
+TEST_F(ART_OBJ_POOL_TEST, TRIM_RACE_TEST)
+{
+    const int THREADS = 4;
+    const int ROUND = 20000;
+
+    /* nodes go back to the heap past a small free limit and through trim while other threads refill */
+    pool.setFreeLimit(64 * sizeof(N4));
+    std::atomic<bool> stop{false};
+    std::atomic<uint64_t> errors{0};
+    std::thread trimmer([&] {
+        while (!stop) pool.trim();
+    });
+    std::vector<std::thread> threads;
+    for (int id = 0; id < THREADS; id++) {
+        threads.emplace_back([&, id] {
+            std::vector<N *> mine;
+            for (int r = 0; r < ROUND; r++) {
+                N *n = pool.newNode(NT4);
+                Stamp(n, uint64_t(id) << 32 | r);
+                mine.push_back(n);
+                if (mine.size() < 96) continue;
+                for (size_t i = 0; i < mine.size(); i++) {
+                    if (!HasStamp(mine[i], uint64_t(id) << 32 | (r - 95 + i))) errors++;
+                    pool.gcNode(mine[i]);
+                }
+                mine.clear();
+            }
+            for (N *n : mine) pool.gcNode(n);
+        });
+    }
+    for (auto &t : threads) t.join();
+    stop = true;
+    trimmer.join();
+
+    EXPECT_EQ(errors.load(), 0U);
+    EXPECT_EQ(pool.stats(NT4).liveNodes, 0U);
+}
+
+TEST_F(ART_OBJ_POOL_TEST, SLAB_TEST)
+{
+    const size_t NUM = 1 << 17;
+    for (auto source : {NodeSource::SLAB, NodeSource::HUGE_SLAB}) {
+        Index::ArtObjPool slabPool(source);
+        if (slabPool.source() == NodeSource::HEAP) break; /* built with ART_ARENA_REFS */
+
+        /* fresh nodes of a type sit side by side */
+        N *first = slabPool.newNode(NT256);
+        N *second = slabPool.newNode(NT256);
+        EXPECT_EQ(std::abs(reinterpret_cast<char *>(second) - reinterpret_cast<char *>(first)), long(sizeof(N256)));
+        slabPool.gcNode(first);
+        slabPool.gcNode(second);
+
+        auto *tree = new ART<KEY32>(&slabPool);
+        std::default_random_engine gen;
+        vector<KEY<KEY32>> keys(NUM);
+        for (size_t i = 0; i < NUM; i++) {
+            uint64_t num = gen();
+            memcpy(&keys[i][0], &num, sizeof(num));
+            memcpy(&keys[i][0] + 8, &i, sizeof(i));
+            tree->insert(keys[i], i);
+        }
+        for (size_t i = 0; i < NUM; i++) {
+            TID tid;
+            ASSERT_EQ(tree->lookup(keys[i], tid), true);
+            EXPECT_EQ(tid, i);
+        }
+        delete tree;
+
+        /* a second tree lives off the nodes the first one gave back */
+        size_t slabs = slabPool.slabCount();
+        EXPECT_GT(slabs, 0U);
+        tree = new ART<KEY32>(&slabPool);
+        for (size_t i = 0; i < NUM; i++) tree->insert(keys[i], i);
+        EXPECT_EQ(slabPool.slabCount(), slabs);
+        delete tree;
+
+        std::cout << slabs << " slabs, " << slabPool.hugeTlbSlabCount() << " on reserved huge pages" << endl;
+    }
+}
+
+TEST_F(ART_OBJ_POOL_TEST, ACCOUNTING_TEST)
+{
+    std::vector<N *> taken;
+    for (int i = 0; i < 100; i++) taken.push_back(pool.newNode(NT4));
+    NodeStats s = pool.stats(NT4);
+    EXPECT_EQ(s.liveNodes, 100U);
+    EXPECT_EQ(s.liveBytes, 100 * sizeof(N4));
+    EXPECT_EQ(s.liveNodes + s.freeNodes, s.peakNodes);
+    for (N *n : taken) pool.gcNode(n);
+    s = pool.stats(NT4);
+    EXPECT_EQ(s.liveNodes, 0U);
+    EXPECT_EQ(s.freeBytes, s.peakBytes);
+
+    /* what goes past the free limit, and all that trim finds, leaves the pool */
+    pool.setFreeLimit(0);
+    taken.clear();
+    for (int i = 0; i < 1000; i++) taken.push_back(pool.newNode(NT16));
+    for (N *n : taken) pool.gcNode(n);
+    s = pool.stats(NT16);
+    EXPECT_EQ(s.liveNodes, 0U);
+    EXPECT_LE(s.freeNodes, 64U);
+    EXPECT_GE(s.peakNodes, 1000U);
+
+    pool.setFreeLimit(SIZE_MAX);
+    taken.clear();
+    for (int i = 0; i < 1000; i++) taken.push_back(pool.newNode(NT48));
+    for (N *n : taken) pool.gcNode(n);
+    EXPECT_GE(pool.trim(), 900 * sizeof(N48));
+    EXPECT_LE(pool.stats(NT48).freeNodes, 64U);
+
+    /* leaves are counted while the tree has them */
+    const size_t NUM = 1 << 16;
+    size_t before = pool.usedBytes();
+    auto *tree = new ART<KEY32>(&pool);
+    std::default_random_engine gen;
+    KEY<KEY32> key;
+    for (size_t i = 0; i < NUM; i++) {
+        uint64_t num = gen();
+        memcpy(&key[0], &num, sizeof(num));
+        memcpy(&key[0] + 8, &i, sizeof(i));
+        tree->insert(key, i);
+    }
+    EXPECT_GE(pool.usedBytes(), before + NUM * (sizeof(KeyLeaf) + KEY32));
+    delete tree;
+
+    size_t nodeBytes = 0;
+    for (auto t : {NT4, NT16, NT48, NT256}) {
+        s = pool.stats(t);
+        EXPECT_EQ(s.liveNodes, 0U);
+        nodeBytes += s.freeBytes;
+    }
+    EXPECT_LT(pool.usedBytes() - nodeBytes, size_t(64 << 10));
+}
+
+TEST_F(ART_OBJ_POOL_TEST, BUDGET_TEST)
+{
+    const size_t BUDGET = 8 << 20;
+    pool.setBudget(BUDGET);
+    auto *tree = new ART<KEY32>(&pool);
+    std::default_random_engine gen;
+    vector<KEY<KEY32>> keys;
+    for (size_t i = 0;; i++) {
+        KEY<KEY32> key;
+        uint64_t num = gen();
+        memcpy(&key[0], &num, sizeof(num));
+        memcpy(&key[0] + 8, &i, sizeof(i));
+        if (!tree->insert(key, i)) {
+            TID tid;
+            EXPECT_EQ(tree->lookup(key, tid), false);
+            break;
+        }
+        keys.push_back(key);
+    }
+    EXPECT_TRUE(pool.overBudget());
+    EXPECT_LT(pool.usedBytes(), BUDGET + (32 * sizeof(N256) + (64 << 10)));
+
+    /* keys already there can still change */
+    EXPECT_EQ(tree->insert(keys[0], 42), true);
+    for (size_t i = 1; i < keys.size(); i++) {
+        TID tid;
+        ASSERT_EQ(tree->lookup(keys[i], tid), true);
+        EXPECT_EQ(tid, i);
+    }
+    std::cout << keys.size() << " keys in " << (BUDGET >> 20) << " MB" << endl;
+    delete tree;
+}
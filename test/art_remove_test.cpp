@@ -0,0 +1,222 @@
+#include <gtest/gtest.h>
+#include <random>
+#include <thread>
+
+#include <index/art_key.h>
+#include <index/art_tree.h>
+#include <index/art_obj_pool.h>
+
+const uint16_t KEY32 = 32;
+const uint16_t KEY64 = 64;
+
+using namespace Index;
+
+class ART_REMOVE_TEST : public ::testing::Test {
+protected:
+    ART<KEY32> *art_tree_32;
+    ART<KEY64> *art_tree_64;
+
+    Index::ArtObjPool pool;
+
+    std::default_random_engine gen;
+
+    template<uint16_t KeyLen>
+    void GenOrderedKey(vector<KEY<KeyLen>>& v, int count) {
+        KEY<KeyLen> r;
+        int idx = KeyLen - 1;
+        for (int i = 0; i < count; i++) {
+            v.push_back(r);
+
+            if (r[idx] == UINT8_MAX) {
+                while (r[idx] == UINT8_MAX) {
+                    r[idx--] = 0;
+                    r[idx] += 1;
+                }
+            } else {
+                r[idx] += 1;
+            }
+            idx = KeyLen - 1;
+        }
+    }
+
+    template<uint16_t KeyLen>
+    void GenRandomKey(vector<KEY<KeyLen>>& v, uint64_t count) {
+        KEY<KeyLen> r;
+        for (uint64_t i = 0; i < count; i++) {
+            uint64_t num = gen();
+            for (int j = 0; j < KeyLen/8; j++) {
+                memmove(&r[0] + 8 * j, &num, sizeof(uint64_t));
+            }
+            memmove(&r[0] + 8, &i, sizeof (uint64_t));
+
+            v.push_back(r);
+        }
+    }
+
+    void SetUp() override {
+        art_tree_32 = new ART<KEY32>(&pool);
+        art_tree_64 = new ART<KEY64>(&pool);
+    }
+
+    void TearDown() override {
+        delete art_tree_32;
+        delete art_tree_64;
+    }
+};
+
+TEST_F(ART_REMOVE_TEST, ORDER_REMOVE_TEST)
+{
+    const int NUM = 100000;
+    vector<KEY<KEY32>> key_list;
+    GenOrderedKey<KEY32>(key_list, NUM);
+    for (int i = 0; i < NUM; i++) {
+        art_tree_32->insert(key_list[i], i);
+    }
+
+    for (int i = 0; i < NUM; i += 2) {
+        EXPECT_EQ(art_tree_32->remove(key_list[i]), true);
+    }
+    EXPECT_EQ(art_tree_32->remove(key_list[0]), false);
+
+    for (int i = 0; i < NUM; i++) {
+        TID tid;
+        bool find = art_tree_32->lookup(key_list[i], tid);
+        EXPECT_EQ(find, i % 2 == 1);
+        if (find) {
+            EXPECT_EQ(tid, i);
+        }
+    }
+
+    for (int i = 1; i < NUM; i += 2) {
+        EXPECT_EQ(art_tree_32->remove(key_list[i]), true);
+    }
+    for (int i = 0; i < NUM; i++) {
+        TID tid;
+        EXPECT_EQ(art_tree_32->lookup(key_list[i], tid), false);
+    }
+
+    /* the tree is empty again, re-inserting must work on top of the shrunk nodes */
+    for (int i = 0; i < NUM; i++) {
+        art_tree_32->insert(key_list[i], i + 1);
+    }
+    for (int i = 0; i < NUM; i++) {
+        TID tid;
+        EXPECT_EQ(art_tree_32->lookup(key_list[i], tid), true);
+        EXPECT_EQ(tid, i + 1);
+    }
+}
+
+TEST_F(ART_REMOVE_TEST, RANDOM_REMOVE_TEST)
+{
+    const size_t NUM = 256*256;
+    vector<KEY<KEY64>> key_list;
+    GenRandomKey<KEY64>(key_list, NUM);
+    for (size_t i = 0; i < NUM; i++) {
+        art_tree_64->insert(key_list[i], i);
+    }
+
+    vector<size_t> order(NUM);
+    for (size_t i = 0; i < NUM; i++) order[i] = i;
+    std::shuffle(order.begin(), order.end(), gen);
+
+    for (size_t i = 0; i < NUM / 2; i++) {
+        EXPECT_EQ(art_tree_64->remove(key_list[order[i]]), true);
+    }
+    for (size_t i = 0; i < NUM; i++) {
+        TID tid;
+        bool find = art_tree_64->lookup(key_list[order[i]], tid);
+        EXPECT_EQ(find, i >= NUM / 2);
+        if (find) {
+            EXPECT_EQ(tid, order[i]);
+        }
+    }
+}
+
+TEST_F(ART_REMOVE_TEST, CONCURRENT_REMOVE_AND_LOOKUP_TEST)
+{
+    const size_t NUM = 256*256*4;
+    const size_t ThreadNum = 4;
+    const size_t CountPerThread = NUM / ThreadNum;
+    vector<KEY<KEY32>> key_list;
+    vector<std::thread*> threads;
+
+    GenRandomKey<KEY32>(key_list, NUM);
+    for (size_t i = 0; i < NUM; i++) {
+        art_tree_32->insert(key_list[i], i);
+    }
+
+    /* even keys are removed while odd keys must stay visible */
+    std::function<void(size_t, size_t)> remove = [&](size_t i, size_t j) {
+        for (size_t k = i; k < j; k += 2) {
+            EXPECT_EQ(art_tree_32->remove(key_list[k]), true);
+        }
+    };
+
+    std::function<void(size_t, size_t)> lookup = [&](size_t i, size_t j) {
+        for (size_t k = i + 1; k < j; k += 2) {
+            TID tid;
+            EXPECT_EQ(art_tree_32->lookup(key_list[k], tid), true);
+            EXPECT_EQ(tid, k);
+        }
+    };
+
+    for (size_t i = 0; i < ThreadNum; i++) {
+        threads.emplace_back(new thread(remove, i * CountPerThread, (i + 1) * CountPerThread));
+        threads.emplace_back(new thread(lookup, i * CountPerThread, (i + 1) * CountPerThread));
+    }
+    for (auto t : threads) {
+        t->join();
+        delete t;
+    }
+
+    for (size_t i = 0; i < NUM; i++) {
+        TID tid;
+        bool find = art_tree_32->lookup(key_list[i], tid);
+        EXPECT_EQ(find, i % 2 == 1);
+    }
+}
+
+TEST_F(ART_REMOVE_TEST, CONCURRENT_CHURN_TEST)
+{
+    const size_t NUM = 256*256*2;
+    const size_t ThreadNum = 4;
+    const size_t CountPerThread = NUM / ThreadNum;
+    vector<KEY<KEY32>> key_list;
+    vector<std::thread*> threads;
+
+    GenRandomKey<KEY32>(key_list, NUM * 2);
+    for (size_t i = 0; i < NUM; i++) {
+        art_tree_32->insert(key_list[i], i);
+    }
+
+    /* writers keep growing and shrinking nodes that readers are passing through */
+    std::function<void(size_t, size_t)> churn = [&](size_t i, size_t j) {
+        for (int round = 0; round < 3; round++) {
+            for (size_t k = i; k < j; k++) {
+                art_tree_32->insert(key_list[NUM + k], NUM + k);
+            }
+            for (size_t k = i; k < j; k++) {
+                EXPECT_EQ(art_tree_32->remove(key_list[NUM + k]), true);
+            }
+        }
+    };
+
+    std::function<void(size_t, size_t)> lookup = [&](size_t i, size_t j) {
+        for (int round = 0; round < 3; round++) {
+            for (size_t k = i; k < j; k++) {
+                TID tid;
+                EXPECT_EQ(art_tree_32->lookup(key_list[k], tid), true);
+                EXPECT_EQ(tid, k);
+            }
+        }
+    };
+
+    for (size_t i = 0; i < ThreadNum; i++) {
+        threads.emplace_back(new thread(churn, i * CountPerThread, (i + 1) * CountPerThread));
+        threads.emplace_back(new thread(lookup, i * CountPerThread, (i + 1) * CountPerThread));
+    }
+    for (auto t : threads) {
+        t->join();
+        delete t;
+    }
+}
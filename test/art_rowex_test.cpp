@@ -0,0 +1,165 @@
+#include <gtest/gtest.h>
+#include <random>
+#include <thread>
+#include <chrono>
+
+#include <index/art_key.h>
+#include <index/art_tree.h>
+#include <index/art_obj_pool.h>
+
+const uint16_t KEY32 = 32;
+
+using namespace Index;
+
+/**
+ * ROWEX trees answer like OLC trees, and their readers keep finding every stable key while
+ * writers grow, shrink, split and merge the nodes around them. With ART_ARENA_REFS the trees
+ * stay OLC and the same checks run on that.
+ */
+class ART_ROWEX_TEST : public ::testing::Test {
+protected:
+    Index::ArtObjPool pool;
+
+    /* few values in the first bytes, so keys share small nodes and prefixes that writers keep changing */
+    static KEY<KEY32> Key(uint64_t i) {
+        KEY<KEY32> key;
+        memset(&key[0], 0, KEY32);
+        key[0] = i % 7;
+        key[1] = 3;
+        key[2] = i / 7 % 29;
+        key[3] = i / 203 % 5;
+        uint64_t rest = __builtin_bswap64(i);
+        memcpy(&key[0] + 8, &rest, sizeof(rest));
+        return key;
+    }
+
+    static vector<TID> Scan(ART<KEY32> *tree) {
+        vector<TID> res;
+        typename ART<KEY32>::Iterator it(tree);
+        KEY<KEY32> low;
+        memset(&low[0], 0, KEY32);
+        for (it.seek(low); it.valid(); it.next()) it.tids(res);
+        return res;
+    }
+};
+
+TEST_F(ART_ROWEX_TEST, SINGLE_THREAD_TEST)
+{
+    const size_t NUM = 1 << 15;
+    auto *olc = new ART<KEY32>(&pool);
+    auto *rowex = new ART<KEY32>(&pool);
+    rowex->setSyncMode(SyncMode::ROWEX);
+    std::default_random_engine gen;
+
+    for (size_t round = 0; round < 4 * NUM; round++) {
+        size_t i = gen() % NUM;
+        switch (gen() % 4) {
+            case 0:
+            case 1:
+                EXPECT_EQ(olc->insert(Key(i), i), rowex->insert(Key(i), i));
+                break;
+            case 2:
+                EXPECT_EQ(olc->insertDuplicate(Key(i), i + NUM), rowex->insertDuplicate(Key(i), i + NUM));
+                break;
+            case 3:
+                EXPECT_EQ(olc->remove(Key(i)), rowex->remove(Key(i)));
+                break;
+        }
+    }
+
+    vector<KEY<KEY32>> keys;
+    for (size_t i = 0; i < NUM; i++) {
+        vector<TID> a, b;
+        EXPECT_EQ(olc->lookupAll(Key(i), a), rowex->lookupAll(Key(i), b));
+        EXPECT_EQ(a, b);
+        keys.push_back(Key(i));
+    }
+    vector<TID> out(NUM);
+    std::unique_ptr<bool[]> found(new bool[NUM]);
+    rowex->lookupBatch(keys.data(), NUM, out.data(), found.get());
+    for (size_t i = 0; i < NUM; i++) {
+        TID tid;
+        ASSERT_EQ(found[i], olc->lookup(keys[i], tid));
+        if (found[i]) {
+            EXPECT_EQ(out[i], tid);
+        }
+    }
+    EXPECT_EQ(Scan(olc), Scan(rowex));
+
+    delete olc;
+    delete rowex;
+}
+
+TEST_F(ART_ROWEX_TEST, CONCURRENT_TEST)
+{
+    const size_t NUM = 1 << 15;
+    const auto RUN = std::chrono::seconds(2);
+
+    /* the same workload on both, readers only ever look for the even keys, which stay */
+    for (auto mode : {SyncMode::OLC, SyncMode::ROWEX}) {
+        auto *tree = new ART<KEY32>(&pool);
+        tree->setSyncMode(mode);
+        for (size_t i = 0; i < NUM; i += 2) tree->insert(Key(i), i);
+
+        std::atomic<bool> stop{false};
+        std::atomic<uint64_t> errors{0}, reads{0};
+        std::vector<std::thread> threads;
+        for (int id = 0; id < 2; id++) {
+            threads.emplace_back([&, id] {
+                std::default_random_engine wgen(id);
+                while (!stop) {
+                    size_t i = wgen() % (NUM / 2) * 2 + 1;
+                    if (wgen() % 2) {
+                        tree->insert(Key(i), i);
+                    } else {
+                        tree->remove(Key(i));
+                    }
+                }
+            });
+        }
+        for (int id = 0; id < 2; id++) {
+            threads.emplace_back([&, id] {
+                std::default_random_engine rgen(id);
+                vector<KEY<KEY32>> batch(16);
+                vector<TID> out(16);
+                std::unique_ptr<bool[]> found(new bool[16]);
+                uint64_t n = 0;
+                while (!stop) {
+                    size_t e = rgen() % (NUM / 2) * 2;
+                    TID tid;
+                    if (!tree->lookup(Key(e), tid) || tid != e) errors++;
+
+                    for (size_t j = 0; j < 16; j++) batch[j] = Key((e + 2 * j) % NUM);
+                    tree->lookupBatch(batch.data(), 16, out.data(), found.get());
+                    for (size_t j = 0; j < 16; j++) {
+                        if (!found[j] || out[j] != (e + 2 * j) % NUM) errors++;
+                    }
+
+                    typename ART<KEY32>::Iterator it(tree);
+                    it.seek(Key(e));
+                    if (!it.valid() || it.key() != Key(e)) errors++;
+                    for (int j = 0; j < 4 && it.valid(); j++) {
+                        KEY<KEY32> last = it.key();
+                        it.next();
+                        if (it.valid() && !(last < it.key())) errors++;
+                    }
+                    n += 18;
+                }
+                reads += n;
+            });
+        }
+        std::this_thread::sleep_for(RUN);
+        stop = true;
+        for (auto &t : threads) t.join();
+
+        EXPECT_EQ(errors.load(), 0U);
+        for (size_t i = 0; i < NUM; i += 2) {
+            TID tid;
+            ASSERT_EQ(tree->lookup(Key(i), tid), true);
+            EXPECT_EQ(tid, i);
+        }
+        std::cout << (tree->syncMode() == SyncMode::ROWEX ? "ROWEX: " : "OLC: ") << reads.load() / RUN.count()
+                  << " reads per second under 2 writers" << endl;
+        delete tree;
+    }
+}
@@ -0,0 +1,123 @@
+#include <gtest/gtest.h>
+#include <random>
+#include <map>
+
+#include <index/art_key.h>
+#include <index/art_tree.h>
+#include <index/art_obj_pool.h>
+#include <index/index_builder.h>
+
+using namespace Index;
+
+using VarKey = KEY<VAR_KEY_LEN>;
+
+class ART_VAR_KEY_TEST : public ::testing::Test {
+protected:
+    ART<VAR_KEY_LEN> *art_tree_var;
+
+    Index::ArtObjPool pool;
+
+    std::default_random_engine gen;
+
+    /* short lower-case strings, so many of them are prefixes of each other */
+    void GenRandomString(vector<std::string>& v, uint64_t count, size_t maxLen) {
+        for (uint64_t i = 0; i < count; i++) {
+            std::string s(1 + gen() % maxLen, 'a');
+            for (auto &c : s) {
+                c = 'a' + gen() % 4;
+            }
+            v.push_back(s);
+        }
+    }
+
+    void SetUp() override {
+        art_tree_var = new ART<VAR_KEY_LEN>(&pool);
+    }
+
+    void TearDown() override {
+        delete art_tree_var;
+    }
+};
+
+TEST_F(ART_VAR_KEY_TEST, INSERT_LOOKUP_TEST)
+{
+    const size_t NUM = 256*256;
+    vector<std::string> str_list;
+    GenRandomString(str_list, NUM * 2, 12);
+
+    std::map<std::string, TID> expect;
+    for (size_t i = 0; i < NUM; i++) {
+        art_tree_var->insert(VarKey(str_list[i]), i);
+        expect[str_list[i]] = i;
+    }
+
+    for (size_t i = 0; i < NUM * 2; i++) {
+        TID tid;
+        bool find = art_tree_var->lookup(VarKey(str_list[i]), tid);
+        EXPECT_EQ(find, expect.count(str_list[i]) == 1);
+        if (find) {
+            EXPECT_EQ(tid, expect[str_list[i]]);
+        }
+    }
+
+    /* scans come back in string order, with their original length */
+    ART<VAR_KEY_LEN>::Iterator it(art_tree_var);
+    auto e = expect.begin();
+    for (it.seek(VarKey()); it.valid(); it.next(), e++) {
+        ASSERT_NE(e, expect.end());
+        EXPECT_EQ(it.key().toString(), e->first);
+        EXPECT_EQ(it.tid(), e->second);
+    }
+    EXPECT_EQ(e, expect.end());
+
+    vector<TID> res;
+    art_tree_var->lookupRange(VarKey(std::string("ab")), VarKey(std::string("abc")), res);
+    vector<TID> range;
+    for (auto r = expect.lower_bound("ab"); r != expect.upper_bound("abc"); r++) {
+        range.push_back(r->second);
+    }
+    EXPECT_EQ(res, range);
+}
+
+TEST_F(ART_VAR_KEY_TEST, REMOVE_TEST)
+{
+    vector<std::string> str_list = {"a", "ab", "abc", "abcd", "abd", "b", "ba"};
+    for (size_t i = 0; i < str_list.size(); i++) {
+        art_tree_var->insert(VarKey(str_list[i]), i);
+    }
+
+    EXPECT_EQ(art_tree_var->remove(VarKey(std::string("abc"))), true);
+    EXPECT_EQ(art_tree_var->remove(VarKey(std::string("abc"))), false);
+    EXPECT_EQ(art_tree_var->remove(VarKey(std::string("abcde"))), false);
+    for (size_t i = 0; i < str_list.size(); i++) {
+        TID tid;
+        EXPECT_EQ(art_tree_var->lookup(VarKey(str_list[i]), tid), str_list[i] != "abc");
+    }
+}
+
+TEST_F(ART_VAR_KEY_TEST, BUILD_TEST)
+{
+    const size_t NUM = 256*64;
+    vector<std::string> str_list;
+    GenRandomString(str_list, NUM, 20);
+
+    vector<VarKey> key_list;
+    vector<TID> tids;
+    for (size_t i = 0; i < NUM; i++) {
+        key_list.emplace_back(str_list[i]);
+        tids.push_back(i);
+    }
+
+    IndexBuilder<VAR_KEY_LEN> builder(art_tree_var);
+    builder.buildParallel(key_list.data(), tids.data(), NUM);
+
+    std::map<std::string, TID> expect;
+    for (size_t i = 0; i < NUM; i++) {
+        expect[str_list[i]] = i;
+    }
+    for (auto &[s, t] : expect) {
+        TID tid;
+        EXPECT_EQ(art_tree_var->lookup(VarKey(s), tid), true);
+        EXPECT_EQ(tid, t);
+    }
+}